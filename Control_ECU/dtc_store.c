@@ -0,0 +1,457 @@
+/*
+ * dtc_store.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "dtc_store.h"
+#include "external_eeprom.h"
+#include "twi.h"
+#include "systick.h"
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Counter totals including the queued events, the copy every reader uses */
+static uint16 g_counter[DTC_COUNT];
+
+/* System tick of the last event of each DTC since boot */
+static uint32 g_lastEventMs[DTC_COUNT];
+static boolean g_lastEventValid[DTC_COUNT];
+
+/* Slot and sequence number of the next record written to the log */
+static uint8 g_nextSlot = 0;
+static uint16 g_nextSeq = 0;
+
+/* Records waiting to be written, oldest at g_queueTail */
+static DtcStore_RecordType g_queue[DTC_STORE_QUEUE_SIZE];
+static uint32 g_queueTimeMs[DTC_STORE_QUEUE_SIZE];
+static uint8 g_queueHead = 0;
+static uint8 g_queueTail = 0;
+static uint8 g_queueCount = 0;
+
+/* Background page write: the descriptor and the page belong to the TWI engine until done */
+static TWI_TransactionType g_write;
+static uint8 g_writePage[DTC_STORE_RECORD_SIZE];
+
+/* TRUE from queueing the write of the record at g_queueTail until its result was taken */
+static boolean g_writeStarted = FALSE;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Calculates the CRC-8 (polynomial 0x07) of a record. The initial value
+ * 0xFF keeps an all-zero page from passing as a record.
+ */
+static uint8 DtcStore_crc8(const uint8 *data, uint8 length)
+{
+    uint8 crc = 0xFF;
+    uint8 i, bit;
+
+    for(i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for(bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8)((crc << 1) ^ 0x07) : (uint8)(crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+/*
+ * Description :
+ * Serializes a record into one EEPROM page, high byte first.
+ */
+static void DtcStore_pack(const DtcStore_RecordType *record, uint8 *page)
+{
+    page[0] = (uint8)((record->freeze_frame.window2_state & 0x03) << 6) |
+              (uint8)((record->freeze_frame.window1_state & 0x03) << 4) | (record->id & 0x0F);
+    page[1] = (uint8)(record->seq >> 8);
+    page[2] = (uint8)record->seq;
+    page[3] = (uint8)(record->uptime_s >> 16);
+    page[4] = (uint8)(record->uptime_s >> 8);
+    page[5] = (uint8)record->uptime_s;
+    page[6] = (uint8)(record->count[DTC_P001_DIST_LOW] >> 8);
+    page[7] = (uint8)record->count[DTC_P001_DIST_LOW];
+    page[8] = (uint8)(record->count[DTC_P002_TEMP_HIGH] >> 8);
+    page[9] = (uint8)record->count[DTC_P002_TEMP_HIGH];
+    page[10] = record->freeze_frame.temperature;
+    page[11] = (uint8)(record->freeze_frame.distance >> 8);
+    page[12] = (uint8)record->freeze_frame.distance;
+    page[13] = (uint8)(record->since_last_s >> 8);
+    page[14] = (uint8)record->since_last_s;
+    page[15] = DtcStore_crc8(page, DTC_STORE_RECORD_SIZE - 1);
+}
+
+/*
+ * Description :
+ * Deserializes a record read from one EEPROM page.
+ */
+static void DtcStore_unpack(const uint8 *page, DtcStore_RecordType *record)
+{
+    record->id = page[0] & 0x0F;
+    record->freeze_frame.window1_state = (page[0] >> 4) & 0x03;
+    record->freeze_frame.window2_state = (page[0] >> 6) & 0x03;
+    record->seq = ((uint16)page[1] << 8) | page[2];
+    record->uptime_s = ((uint32)page[3] << 16) | ((uint32)page[4] << 8) | page[5];
+    record->count[DTC_P001_DIST_LOW] = ((uint16)page[6] << 8) | page[7];
+    record->count[DTC_P002_TEMP_HIGH] = ((uint16)page[8] << 8) | page[9];
+    record->freeze_frame.temperature = page[10];
+    record->freeze_frame.distance = ((uint16)page[11] << 8) | page[12];
+    record->since_last_s = ((uint16)page[13] << 8) | page[14];
+}
+
+/*
+ * Description :
+ * Returns TRUE if the record ID belongs to a written record.
+ */
+static boolean DtcStore_isValidId(uint8 id)
+{
+    return (id < DTC_COUNT) || (DTC_STORE_CLEAR_ID == id);
+}
+
+/*
+ * Description :
+ * Reads and unpacks the record in a slot. Returns FALSE if the slot can not
+ * be read, was never written or was torn by a reset during its write.
+ */
+static boolean DtcStore_readSlot(uint8 slot, DtcStore_RecordType *record)
+{
+    uint8 page[DTC_STORE_RECORD_SIZE];
+
+    if(EEPROM_readBlock((uint16)slot * DTC_STORE_RECORD_SIZE, page, DTC_STORE_RECORD_SIZE) != SUCCESS)
+    {
+        return FALSE;
+    }
+    if(DtcStore_crc8(page, DTC_STORE_RECORD_SIZE - 1) != page[DTC_STORE_RECORD_SIZE - 1])
+    {
+        return FALSE;
+    }
+    DtcStore_unpack(page, record);
+
+    return DtcStore_isValidId(record->id) && ((record->seq % DTC_STORE_RECORD_COUNT) == slot);
+}
+
+/*
+ * Description :
+ * Returns TRUE if one of the two slots after slot still continues the run
+ * of sequence numbers that starts at slot 0, the binary search then stopped
+ * at a hole instead of the newest record.
+ */
+static boolean DtcStore_runContinues(const DtcStore_RecordType *first, uint8 slot)
+{
+    DtcStore_RecordType record;
+    uint8 next;
+
+    for(next = slot + 1; (next <= (slot + 2)) && (next < DTC_STORE_RECORD_COUNT); next++)
+    {
+        if(DtcStore_readSlot(next, &record) && ((uint16)(record.seq - first->seq) == next))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Reads every slot and keeps the valid record with the highest sequence
+ * number. Returns FALSE if the log holds no valid record.
+ */
+static boolean DtcStore_scanNewest(DtcStore_RecordType *newest)
+{
+    DtcStore_RecordType record;
+    boolean found = FALSE;
+    uint8 slot;
+
+    for(slot = 0; slot < DTC_STORE_RECORD_COUNT; slot++)
+    {
+        if(DtcStore_readSlot(slot, &record) && (!found || ((sint16)(record.seq - newest->seq) > 0)))
+        {
+            *newest = record;
+            found = TRUE;
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Description :
+ * Runs the writes until the queue holds at most count records. A write that
+ * does not get there in DTC_STORE_WRITE_TIMEOUT_MS has a stuck bus or a dead
+ * EEPROM behind it: the TWI engine is cancelled, which also recovers the
+ * bus, and FALSE returned. The records stay queued for a later try.
+ */
+static boolean DtcStore_drain(uint8 count)
+{
+    uint32 start_ms = Systick_getMs();
+
+    while(g_queueCount > count)
+    {
+        if(Systick_isElapsed(start_ms, DTC_STORE_WRITE_TIMEOUT_MS))
+        {
+            TWI_cancel();
+            /* Record the cancelled write for EEPROM_getLastError */
+            EEPROM_getAsyncResult(&g_write);
+            return FALSE;
+        }
+        DtcStore_service(TRUE);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Adds a record with the current counters to the queue, waiting for the
+ * oldest one to be written if the queue is full. Returns FALSE if it stayed full.
+ */
+static boolean DtcStore_queue(uint8 id, const DtcStore_FreezeFrameType *freeze_frame, uint16 since_last_s)
+{
+    DtcStore_RecordType *record;
+    uint32 now_ms;
+    uint8 i;
+
+    if(!DtcStore_drain(DTC_STORE_QUEUE_SIZE - 1))
+    {
+        return FALSE;
+    }
+
+    now_ms = Systick_getMs();
+    record = &g_queue[g_queueHead];
+    record->id = id;
+    record->uptime_s = now_ms / 1000;
+    for(i = 0; i < DTC_COUNT; i++)
+    {
+        record->count[i] = g_counter[i];
+    }
+    record->freeze_frame = *freeze_frame;
+    record->since_last_s = since_last_s;
+    g_queueTimeMs[g_queueHead] = now_ms;
+
+    g_queueHead = (g_queueHead + 1) % DTC_STORE_QUEUE_SIZE;
+    g_queueCount++;
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Finds the newest valid record and loads the counters from it. Slot 0 up
+ * to the newest record hold the current lap of the ring, their sequence
+ * numbers follow on from slot 0. The slots after it hold the previous lap,
+ * are erased or, for the slot right after it, torn. So the end of the
+ * current lap is found by a binary search. If the run goes on behind the
+ * slot found, a bad slot in its middle misled the search, and if slot 0 is
+ * bad there is nothing to search from: both cases read the whole log.
+ * An erased log starts at slot 0.
+ */
+void DtcStore_init(void)
+{
+    uint8 low, high, mid;
+    boolean found = FALSE;
+    DtcStore_RecordType first, record, newest;
+
+    g_counter[DTC_P001_DIST_LOW] = 0;
+    g_counter[DTC_P002_TEMP_HIGH] = 0;
+    g_lastEventValid[DTC_P001_DIST_LOW] = FALSE;
+    g_lastEventValid[DTC_P002_TEMP_HIGH] = FALSE;
+    g_nextSlot = 0;
+    g_nextSeq = 0;
+
+    if(DtcStore_readSlot(0, &first))
+    {
+        /* Slot low is always in the current lap, no slot after high is */
+        newest = first;
+        low = 0;
+        high = DTC_STORE_RECORD_COUNT - 1;
+        while(low < high)
+        {
+            mid = low + (high - low + 1) / 2;
+            if(DtcStore_readSlot(mid, &record) && ((uint16)(record.seq - first.seq) == mid))
+            {
+                newest = record;
+                low = mid;
+            }
+            else
+            {
+                high = mid - 1;
+            }
+        }
+        found = DtcStore_runContinues(&first, low) ? DtcStore_scanNewest(&newest) : TRUE;
+    }
+    else
+    {
+        found = DtcStore_scanNewest(&newest);
+    }
+
+    if(found)
+    {
+        g_counter[DTC_P001_DIST_LOW] = newest.count[DTC_P001_DIST_LOW];
+        g_counter[DTC_P002_TEMP_HIGH] = newest.count[DTC_P002_TEMP_HIGH];
+        g_nextSeq = newest.seq + 1;
+        g_nextSlot = g_nextSeq % DTC_STORE_RECORD_COUNT;
+    }
+}
+
+/*
+ * Description :
+ * Returns the RAM copy of a counter, limited to 8 bits.
+ */
+uint8 DtcStore_get(DtcStore_IdType id)
+{
+    return (g_counter[id] > 0xFF) ? 0xFF : (uint8)g_counter[id];
+}
+
+/*
+ * Description :
+ * Counts the event and queues its record with the freeze-frame.
+ */
+boolean DtcStore_increment(DtcStore_IdType id, const DtcStore_FreezeFrameType *freeze_frame)
+{
+    uint32 now_ms = Systick_getMs();
+    uint32 since_s = DTC_STORE_SINCE_UNKNOWN;
+
+    if(g_lastEventValid[id])
+    {
+        since_s = (now_ms - g_lastEventMs[id]) / 1000;
+        if(since_s >= DTC_STORE_SINCE_UNKNOWN)
+        {
+            since_s = DTC_STORE_SINCE_UNKNOWN - 1;
+        }
+    }
+    g_lastEventMs[id] = now_ms;
+    g_lastEventValid[id] = TRUE;
+
+    g_counter[id]++;
+    return DtcStore_queue(id, freeze_frame, (uint16)since_s);
+}
+
+/*
+ * Description :
+ * Walks the log back from the newest record while the sequence numbers
+ * keep going down by one. A bad slot is skipped, more than
+ * DTC_STORE_MAX_HOLE in a row are the end of the log (erased slots or
+ * stale records of an older lap).
+ */
+boolean DtcStore_readEvent(uint8 index, DtcStore_RecordType *record)
+{
+    uint8 slot = g_nextSlot;
+    uint16 seq;
+    uint8 step;
+    uint8 misses = 0;
+
+    DtcStore_flush();
+    seq = g_nextSeq;
+
+    for(step = 0; step < DTC_STORE_RECORD_COUNT; step++)
+    {
+        slot = (slot + DTC_STORE_RECORD_COUNT - 1) % DTC_STORE_RECORD_COUNT;
+        seq--;
+
+        if(!DtcStore_readSlot(slot, record) || (record->seq != seq))
+        {
+            if(++misses > DTC_STORE_MAX_HOLE)
+            {
+                return FALSE;
+            }
+            continue;
+        }
+        misses = 0;
+
+        if(record->id != DTC_STORE_CLEAR_ID)
+        {
+            if(0 == index)
+            {
+                return TRUE;
+            }
+            index--;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Zeroes every counter and logs it.
+ */
+boolean DtcStore_clearAll(void)
+{
+    DtcStore_FreezeFrameType none = {0, 0, 0, 0};
+    uint8 id;
+
+    for(id = 0; id < DTC_COUNT; id++)
+    {
+        g_counter[id] = 0;
+    }
+
+    return DtcStore_queue(DTC_STORE_CLEAR_ID, &none, DTC_STORE_SINCE_UNKNOWN) && DtcStore_flush();
+}
+
+/*
+ * Description :
+ * Writes the oldest queued record to the next slot when idle or too old.
+ * The record stays queued and the slot and sequence number stay put until
+ * the EEPROM confirmed the write, a failed write is repeated to the same
+ * slot with the same sequence number so the log never gets a hole.
+ */
+void DtcStore_service(boolean idle)
+{
+    DtcStore_RecordType *record;
+
+    if(TWI_isPending(&g_write))
+    {
+        return;
+    }
+
+    if(g_writeStarted)
+    {
+        g_writeStarted = FALSE;
+        if(EEPROM_getAsyncResult(&g_write) == SUCCESS)
+        {
+            g_nextSlot = (g_nextSlot + 1) % DTC_STORE_RECORD_COUNT;
+            g_nextSeq++;
+            g_queueTail = (g_queueTail + 1) % DTC_STORE_QUEUE_SIZE;
+            g_queueCount--;
+        }
+    }
+
+    if(0 == g_queueCount)
+    {
+        return;
+    }
+
+    if(!idle && !Systick_isElapsed(g_queueTimeMs[g_queueTail], DTC_STORE_MAX_DIRTY_MS))
+    {
+        return;
+    }
+
+    record = &g_queue[g_queueTail];
+    record->seq = g_nextSeq;
+    DtcStore_pack(record, g_writePage);
+    if(EEPROM_writeAsync(&g_write, (uint16)g_nextSlot * DTC_STORE_RECORD_SIZE, g_writePage,
+                         DTC_STORE_RECORD_SIZE, NULL_PTR) == SUCCESS)
+    {
+        g_writeStarted = TRUE;
+    }
+}
+
+/*
+ * Description :
+ * Writes every queued record, the last one is only dequeued once the
+ * EEPROM ended its write cycle.
+ */
+boolean DtcStore_flush(void)
+{
+    return DtcStore_drain(0);
+}
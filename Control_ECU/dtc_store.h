@@ -0,0 +1,156 @@
+/*
+ * dtc_store.h
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#ifndef DTC_STORE_H_
+#define DTC_STORE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * The whole 24C16 is a circular log of fixed size records, one record per
+ * 16-byte page, so every page takes its share of the writes and a record
+ * with its freeze-frame is stored by one page write:
+ *
+ *   | W2 W1 ID | SEQ (2) | UPTIME s (3) | P001 count (2) | P002 count (2) |
+ *   | TEMP | DISTANCE (2) | SINCE LAST s (2) | CRC8 |
+ *
+ * The first byte holds the window states in bits 7..6 (window 2) and
+ * 5..4 (window 1) and the ID in bits 3..0: the DTC that fired or
+ * DTC_STORE_CLEAR_ID. SEQ grows by one per record and the counts are the
+ * totals after this event, so the newest record alone gives every counter
+ * even after older records were overwritten. TEMP, DISTANCE and the window
+ * states are the freeze-frame taken when the DTC fired, SINCE LAST is the
+ * time since the previous event of the same DTC.
+ * Multi-byte values are stored high byte first.
+ *
+ * Records are written to the slots in order and SEQ modulo the record count
+ * is always the slot number. CRC8 (polynomial 0x07, initial value 0xFF)
+ * covers the first 15 bytes, so a page torn by a reset during its write
+ * cycle is ignored and the record before it is the newest one.
+ */
+#define DTC_STORE_RECORD_SIZE       EEPROM_PAGE_SIZE
+#define DTC_STORE_RECORD_COUNT      (EEPROM_SIZE / DTC_STORE_RECORD_SIZE)
+
+/* Record IDs that are not a DTC (erased EEPROM reads as ID 0x0F) */
+#define DTC_STORE_CLEAR_ID          0x0E    /* Counters were cleared */
+
+/* Time since the last event when there was none since boot */
+#define DTC_STORE_SINCE_UNKNOWN     0xFFFF
+
+/* Events waiting in RAM to be written to the log */
+#define DTC_STORE_QUEUE_SIZE        4
+
+/* Longest time an event may stay in RAM only while the ECU is busy */
+#define DTC_STORE_MAX_DIRTY_MS      5000
+
+/*
+ * Longest wait for the queue to make room or to empty. After it the TWI
+ * engine is cancelled and the bus recovered, the records stay queued.
+ */
+#define DTC_STORE_WRITE_TIMEOUT_MS  200
+
+/* Unreadable or stale slots in a row skipped when walking the log back */
+#define DTC_STORE_MAX_HOLE          1
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* Diagnostic trouble codes, also the index in the faults payload */
+typedef enum {
+    DTC_P001_DIST_LOW,
+    DTC_P002_TEMP_HIGH,
+    DTC_COUNT
+} DtcStore_IdType;
+
+/* Conditions when a DTC fired */
+typedef struct {
+    uint8 temperature;          /* Engine temperature in C */
+    uint16 distance;            /* Obstacle distance in cm */
+    uint8 window1_state;        /* DcMotor_State of window 1 */
+    uint8 window2_state;        /* DcMotor_State of window 2 */
+} DtcStore_FreezeFrameType;
+
+/* One log record */
+typedef struct {
+    uint8 id;                   /* DtcStore_IdType or DTC_STORE_CLEAR_ID */
+    uint16 seq;                 /* Record sequence number */
+    uint32 uptime_s;            /* Seconds since boot when the event happened (24 bits) */
+    uint16 count[DTC_COUNT];    /* Counter totals after this event */
+    DtcStore_FreezeFrameType freeze_frame;
+    uint16 since_last_s;        /* Seconds since the previous event of this DTC, or DTC_STORE_SINCE_UNKNOWN */
+} DtcStore_RecordType;
+
+/*******************************************************************************
+ *                              Functions Prototypes                           *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Finds the newest valid record of the log with a binary search over the
+ * slots (at most 10 page reads instead of 128) and takes the counters from
+ * it. An empty log or one with a hole in its sequence run is read in full.
+ * Call once at boot, after TWI_init and Systick_init.
+ */
+void DtcStore_init(void);
+
+/*
+ * Description :
+ * Returns a counter from RAM, no bus access. Saturates at 255 for the
+ * 8-bit link payloads, the log keeps 16-bit totals.
+ */
+uint8 DtcStore_get(DtcStore_IdType id);
+
+/*
+ * Description :
+ * Counts one more event in RAM and queues its log record with the
+ * freeze-frame for the next flush. Waits for the oldest queued record to
+ * be written if the queue is full, at most DTC_STORE_WRITE_TIMEOUT_MS.
+ * Returns FALSE if the record could not be queued, the event is only
+ * counted in RAM then (EEPROM_getLastError tells why until the next access).
+ */
+boolean DtcStore_increment(DtcStore_IdType id, const DtcStore_FreezeFrameType *freeze_frame);
+
+/*
+ * Description :
+ * Reads the index-th newest DTC event from the log (0 is the newest),
+ * clear records and up to DTC_STORE_MAX_HOLE bad slots in a row are
+ * skipped. Queued events are written first.
+ * Returns FALSE when the log holds fewer events.
+ */
+boolean DtcStore_readEvent(uint8 index, DtcStore_RecordType *record);
+
+/*
+ * Description :
+ * Sets every counter to zero and logs a clear record right away.
+ * Returns FALSE if the clear record could not be written.
+ */
+boolean DtcStore_clearAll(void);
+
+/*
+ * Description :
+ * Starts the background EEPROM write of the next queued record when the
+ * caller is idle or the oldest queued event reached DTC_STORE_MAX_DIRTY_MS.
+ * A record leaves the queue once the EEPROM stored it, a failed write is
+ * repeated. Cheap enough to call on every loop iteration.
+ */
+void DtcStore_service(boolean idle);
+
+/*
+ * Description :
+ * Writes every queued record and waits until the EEPROM stored them, at
+ * most DTC_STORE_WRITE_TIMEOUT_MS. Use before power down or a reset.
+ * Returns FALSE if records are still queued.
+ */
+boolean DtcStore_flush(void);
+
+#endif /* DTC_STORE_H_ */
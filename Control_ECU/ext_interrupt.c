@@ -0,0 +1,146 @@
+ /*
+ * ext_interrupt.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "ext_interrupt.h"
+#include "common_macros.h" /* To use the macros like SET_BIT */
+#include <avr/io.h> /* To use the external interrupt Registers */
+#include <avr/interrupt.h> /* For INT0, INT1 and INT2 ISRs */
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Global variables to hold the address of the call back functions in the application */
+static void (*volatile g_callBackPtr[3])(void) = { NULL_PTR, NULL_PTR, NULL_PTR };
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+ISR(INT0_vect)
+{
+	if(g_callBackPtr[EXT_INT0] != NULL_PTR)
+	{
+		(*g_callBackPtr[EXT_INT0])();
+	}
+}
+
+ISR(INT1_vect)
+{
+	if(g_callBackPtr[EXT_INT1] != NULL_PTR)
+	{
+		(*g_callBackPtr[EXT_INT1])();
+	}
+}
+
+ISR(INT2_vect)
+{
+	if(g_callBackPtr[EXT_INT2] != NULL_PTR)
+	{
+		(*g_callBackPtr[EXT_INT2])();
+	}
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+/*
+ * Description : Function to initialize an external interrupt
+ * 	1. Set its pin as input: INT0/PD2, INT1/PD3 or INT2/PB2.
+ * 	2. Set the required edge detection.
+ * 	3. Enable the interrupt.
+ */
+void ExtInt_init(const ExtInt_ConfigType * Config_Ptr)
+{
+	switch(Config_Ptr->id)
+	{
+	case EXT_INT0:
+		DDRD &= ~(1<<PD2);
+		break;
+	case EXT_INT1:
+		DDRD &= ~(1<<PD3);
+		break;
+	case EXT_INT2:
+		DDRB &= ~(1<<PB2);
+		break;
+	}
+
+	/* Also drops the request the edge change may have raised */
+	ExtInt_setEdgeDetectionType(Config_Ptr->id, Config_Ptr->edge);
+
+	switch(Config_Ptr->id)
+	{
+	case EXT_INT0:
+		GICR |= (1<<INT0);
+		break;
+	case EXT_INT1:
+		GICR |= (1<<INT1);
+		break;
+	case EXT_INT2:
+		GICR |= (1<<INT2);
+		break;
+	}
+}
+
+/*
+ * Description: Function to set the Call Back function address of an interrupt.
+ */
+void ExtInt_setCallBack(ExtInt_IdType id, void(*a_ptr)(void))
+{
+	/* Save the address of the Call back function in a global variable */
+	g_callBackPtr[id] = a_ptr;
+}
+
+/*
+ * Description: Function to set the required edge detection of an interrupt.
+ * 	Changing the edge can raise a request of its own, so the flag is cleared after.
+ */
+void ExtInt_setEdgeDetectionType(ExtInt_IdType id, const ExtInt_EdgeType a_edgeType)
+{
+	uint8 enabled;
+
+	switch(id)
+	{
+	case EXT_INT0:
+		/* ISC01:ISC00 = 10 falling edge, 11 rising edge */
+		MCUCR = (MCUCR & ~((1<<ISC01) | (1<<ISC00))) | (1<<ISC01) | (a_edgeType<<ISC00);
+		GIFR = (1<<INTF0);
+		break;
+	case EXT_INT1:
+		/* ISC11:ISC10 = 10 falling edge, 11 rising edge */
+		MCUCR = (MCUCR & ~((1<<ISC11) | (1<<ISC10))) | (1<<ISC11) | (a_edgeType<<ISC10);
+		GIFR = (1<<INTF1);
+		break;
+	case EXT_INT2:
+		/* INT2 has to be disabled while ISC2 changes, ISC2 = 0 falling edge, 1 rising edge */
+		enabled = GICR & (1<<INT2);
+		GICR &= ~(1<<INT2);
+		MCUCSR = (MCUCSR & ~(1<<ISC2)) | (a_edgeType<<ISC2);
+		GIFR = (1<<INTF2);
+		GICR |= enabled;
+		break;
+	}
+}
+
+/*
+ * Description: Function to disable an external interrupt
+ */
+void ExtInt_DeInit(ExtInt_IdType id)
+{
+	switch(id)
+	{
+	case EXT_INT0:
+		GICR &= ~(1<<INT0);
+		break;
+	case EXT_INT1:
+		GICR &= ~(1<<INT1);
+		break;
+	case EXT_INT2:
+		GICR &= ~(1<<INT2);
+		break;
+	}
+}
@@ -0,0 +1,58 @@
+ /*
+ * ext_interrupt.h
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#ifndef EXT_INTERRUPT_H_
+#define EXT_INTERRUPT_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+typedef enum
+{
+	EXT_INT0,EXT_INT1,EXT_INT2
+}ExtInt_IdType;
+
+typedef enum
+{
+	EXT_INT_FALLING,EXT_INT_RISING
+}ExtInt_EdgeType;
+
+typedef struct
+{
+	ExtInt_IdType id;
+	ExtInt_EdgeType edge;
+}ExtInt_ConfigType;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+/*
+ * Description : Function to initialize an external interrupt
+ * 	1. Set its pin as input: INT0/PD2, INT1/PD3 or INT2/PB2.
+ * 	2. Set the required edge detection.
+ * 	3. Enable the interrupt.
+ */
+void ExtInt_init(const ExtInt_ConfigType * Config_Ptr);
+
+/*
+ * Description: Function to set the Call Back function address of an interrupt.
+ */
+void ExtInt_setCallBack(ExtInt_IdType id, void(*a_ptr)(void));
+
+/*
+ * Description: Function to set the required edge detection of an interrupt.
+ */
+void ExtInt_setEdgeDetectionType(ExtInt_IdType id, const ExtInt_EdgeType edgeType);
+
+/*
+ * Description: Function to disable an external interrupt
+ */
+void ExtInt_DeInit(ExtInt_IdType id);
+
+#endif /* EXT_INTERRUPT_H_ */
@@ -7,72 +7,208 @@
 
 #include "external_eeprom.h"
 #include "twi.h"
+#include "systick.h"
 
-uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data)
+/* Device address with the A8 A9 A10 block select bits of the memory location and R/W=0 */
+#define EEPROM_DEVICE_ADDRESS(addr) ((uint8)(0xA0 | (((addr) & 0x0700)>>7)))
+
+/* Result of the last EEPROM access, TWI_OK or the TWI stage that failed */
+static TWI_ErrorType g_lastError = TWI_OK;
+
+/*
+ * Keeps the TWI result for EEPROM_getLastError and turns it into the
+ * SUCCESS/ERROR result of the driver. The TWI functions already released
+ * the bus on an error.
+ */
+static uint8 EEPROM_result(TWI_ErrorType error)
 {
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)(0xA0 | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR; 
-		 
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-		
-    /* write byte to eeprom */
-    TWI_writeByte(u8data);
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
+    g_lastError = error;
+
+    if (error != TWI_OK)
         return ERROR;
 
-    /* Send the Stop Bit */
-    TWI_stop();
-	
     return SUCCESS;
 }
 
+/*
+ * Sends the start bit, the device address with the A8 A9 A10 block select
+ * bits and R/W=0, then the low byte of the memory location address.
+ */
+static TWI_ErrorType EEPROM_selectAddress(uint16 u16addr)
+{
+    TWI_ErrorType error;
+
+    error = TWI_startTransfer(EEPROM_DEVICE_ADDRESS(u16addr));
+    if (TWI_OK == error)
+        error = TWI_writeData((uint8)(u16addr));
+
+    return error;
+}
+
+/*
+ * ACK polling: the 24C16 does not answer its address during the internal
+ * write cycle, so keep sending START + SLA+W until it ACKs or the timeout passes.
+ * A NACKed poll ends with the STOP of the failed transfer. Any other error
+ * is a bus problem and ends the polling at once.
+ */
+static TWI_ErrorType EEPROM_waitReady(uint16 u16addr)
+{
+    uint32 start_ms = Systick_getMs();
+    TWI_ErrorType error;
+
+    do
+    {
+        error = TWI_startTransfer(EEPROM_DEVICE_ADDRESS(u16addr));
+        if (TWI_OK == error)
+            return TWI_stopTransfer();
+        if (error != TWI_ERROR_ADDRESS)
+            return error;
+    } while (!Systick_isElapsed(start_ms, EEPROM_READY_TIMEOUT_MS));
+
+    return error;
+}
+
+uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data)
+{
+    TWI_ErrorType error;
+
+    /* Start bit, device address with R/W=0 (write) and the memory location address */
+    error = EEPROM_selectAddress(u16addr);
+
+    /* write byte to eeprom */
+    if (TWI_OK == error)
+        error = TWI_writeData(u8data);
+
+    /* Send the Stop Bit, it starts the internal write cycle */
+    if (TWI_OK == error)
+        error = TWI_stopTransfer();
+
+    if (TWI_OK == error)
+        error = EEPROM_waitReady(u16addr);
+
+    return EEPROM_result(error);
+}
+
 uint8 EEPROM_readByte(uint16 u16addr, uint8 *u8data)
 {
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR;
-		
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
+    /* A one byte sequential read: the only byte is not acknowledged */
+    return EEPROM_readBlock(u16addr, u8data, 1);
+}
+
+uint8 EEPROM_writeAsync(TWI_TransactionType *transaction, uint16 u16addr, uint8 *data, uint8 length,
+                        void (*callback)(TWI_TransactionType *transaction))
+{
+    if (TWI_isPending(transaction))
         return ERROR;
-		
-    /* Send the Repeated Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_REP_START)
+
+    /* The 24C16 wraps a write at the page end onto the start of the same page */
+    if ((0 == length) || (u16addr >= EEPROM_SIZE) || (length > (EEPROM_SIZE - u16addr)) ||
+        (((u16addr & (EEPROM_PAGE_SIZE - 1)) + length) > EEPROM_PAGE_SIZE))
         return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=1 (Read) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7) | 1));
-    if (TWI_getStatus() != TWI_MT_SLA_R_ACK)
+
+    /* Same device address and block select bits as the blocking write */
+    transaction->slave_address = EEPROM_DEVICE_ADDRESS(u16addr);
+    transaction->direction = TWI_WRITE;
+    transaction->flags = TWI_FLAG_WAIT_READY;
+    transaction->header[0] = (uint8)(u16addr);
+    transaction->header_length = 1;
+    transaction->data = data;
+    transaction->length = length;
+    transaction->callback = callback;
+
+    return TWI_submit(transaction) ? SUCCESS : ERROR;
+}
+
+uint8 EEPROM_getAsyncResult(const TWI_TransactionType *transaction)
+{
+    if (TWI_TRANSACTION_DONE == transaction->status)
+    {
+        g_lastError = TWI_OK;
+        return SUCCESS;
+    }
+
+    /* The bus status that ended the transaction, as the stage of a blocking call */
+    switch (transaction->error_status)
+    {
+    case TWI_MT_SLA_W_NACK:
+        g_lastError = TWI_ERROR_ADDRESS;
+        break;
+    case TWI_MT_DATA_NACK:
+        g_lastError = TWI_ERROR_DATA;
+        break;
+    case TWI_NO_STATE:
+        /* Cancelled, the engine got stuck */
+        g_lastError = TWI_ERROR_BUSY;
+        break;
+    default:
+        /* Bus error or arbitration lost */
+        g_lastError = TWI_ERROR_START;
+        break;
+    }
+
+    return ERROR;
+}
+
+uint8 EEPROM_writePage(uint16 u16addr, const uint8 *buf, uint16 len)
+{
+    TWI_ErrorType error = TWI_OK;
+    uint8 chunk;
+    uint8 i;
+
+    if ((u16addr >= EEPROM_SIZE) || (len > (EEPROM_SIZE - u16addr)))
         return ERROR;
 
-    /* Read Byte from Memory without send ACK */
-    *u8data = TWI_readByteWithNACK();
-    if (TWI_getStatus() != TWI_MR_DATA_NACK)
+    while ((len > 0) && (TWI_OK == error))
+    {
+        /* Bytes left in the page of u16addr */
+        chunk = EEPROM_PAGE_SIZE - (u16addr & (EEPROM_PAGE_SIZE - 1));
+        if (chunk > len)
+            chunk = (uint8)len;
+
+        error = EEPROM_selectAddress(u16addr);
+        for (i = 0; (i < chunk) && (TWI_OK == error); i++)
+            error = TWI_writeData(buf[i]);
+
+        /* The stop bit starts the internal write cycle of the page */
+        if (TWI_OK == error)
+            error = TWI_stopTransfer();
+        if (TWI_OK == error)
+            error = EEPROM_waitReady(u16addr);
+
+        u16addr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return EEPROM_result(error);
+}
+
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *buf, uint16 len)
+{
+    TWI_ErrorType error;
+    uint16 i;
+
+    if ((0 == len) || (u16addr >= EEPROM_SIZE) || (len > (EEPROM_SIZE - u16addr)))
         return ERROR;
 
+    error = EEPROM_selectAddress(u16addr);
+
+    /* Repeated Start Bit and the device address with R/W=1 (Read) */
+    if (TWI_OK == error)
+        error = TWI_restartTransfer(EEPROM_DEVICE_ADDRESS(u16addr) | 1);
+
+    /* ACK keeps the internal address counter running, NACK ends the read */
+    for (i = 0; (i < len) && (TWI_OK == error); i++)
+        error = TWI_readData(&buf[i], (i < (len - 1)));
+
     /* Send the Stop Bit */
-    TWI_stop();
+    if (TWI_OK == error)
+        error = TWI_stopTransfer();
 
-    return SUCCESS;
+    return EEPROM_result(error);
+}
+
+TWI_ErrorType EEPROM_getLastError(void)
+{
+    return g_lastError;
 }
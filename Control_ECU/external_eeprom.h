@@ -9,6 +9,7 @@
 #define EXTERNAL_EEPROM_H_
 
 #include "std_types.h"
+#include "twi.h"
 
 /*******************************************************************************
  *                      Preprocessor Macros                                    *
@@ -17,6 +18,18 @@
 #define ERROR 0
 #define SUCCESS 1
 
+/* 24C16 capacity in bytes (16 Kbit) */
+#define EEPROM_SIZE 2048
+
+/* 24C16 write page, a page write wraps around inside its page */
+#define EEPROM_PAGE_SIZE 16
+
+/*
+ * Longest wait for the 24C16 internal write cycle (5 ms max in the datasheet).
+ * The driver polls the device address and goes on as soon as the EEPROM ACKs.
+ */
+#define EEPROM_READY_TIMEOUT_MS 10
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
@@ -29,7 +42,11 @@
  *  u16addr: The 16-bit address in EEPROM to write the data byte.
  *  u8data: The data byte to be written.
  *
- *  returns: SUCCESS if the write operation was successful, ERROR otherwise.
+ * Returns once the EEPROM finished its internal write cycle, so the next
+ * access can follow without a delay.
+ *
+ *  returns: SUCCESS if the write operation was successful, ERROR otherwise
+ *           (including a write cycle longer than EEPROM_READY_TIMEOUT_MS).
  */
 uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
 
@@ -44,5 +61,82 @@ uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
  *  returns: SUCCESS if the read operation was successful, ERROR otherwise.
  */
 uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
+
+/*
+ * Function: EEPROM_writePage
+ * --------------------------
+ * Writes a buffer to the external EEPROM with page writes, one transaction
+ * per 16-byte page touched. A buffer crossing a page boundary is split and
+ * each part gets the block select bits of its own address. Each page write
+ * waits for the end of the write cycle by polling, like EEPROM_writeByte.
+ *
+ *  u16addr: The 16-bit address in EEPROM of the first byte.
+ *  buf: The bytes to be written.
+ *  len: Number of bytes to write.
+ *
+ *  returns: SUCCESS if all pages were written, ERROR otherwise.
+ */
+uint8 EEPROM_writePage(uint16 u16addr, const uint8 *buf, uint16 len);
+
+/*
+ * Function: EEPROM_readBlock
+ * --------------------------
+ * Reads a buffer from the external EEPROM with one sequential read: every
+ * byte but the last is acknowledged so the EEPROM keeps sending.
+ *
+ *  u16addr: The 16-bit address in EEPROM of the first byte.
+ *  buf: Buffer for the read bytes.
+ *  len: Number of bytes to read.
+ *
+ *  returns: SUCCESS if the read operation was successful, ERROR otherwise.
+ */
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *buf, uint16 len);
+
+/*
+ * Function: EEPROM_writeAsync
+ * ---------------------------
+ * Queues a write of length bytes on the interrupt driven TWI engine and
+ * returns at once. The transaction only finishes once the EEPROM ended its
+ * internal write cycle, so the next access needs no delay.
+ * The bytes must stay inside one 16-byte page.
+ *
+ *  transaction: Descriptor owned by the caller, busy until TWI_isPending is FALSE.
+ *  u16addr: The 16-bit address in EEPROM of the first byte.
+ *  data: The bytes to be written, must stay valid until the write finished.
+ *  length: Number of bytes to write.
+ *  callback: Called from the TWI interrupt when finished, may be NULL_PTR.
+ *
+ *  returns: SUCCESS if the write was queued, ERROR if the descriptor is still
+ *           busy or the bytes are empty, run past the end of the EEPROM or
+ *           cross a page boundary.
+ */
+uint8 EEPROM_writeAsync(TWI_TransactionType *transaction, uint16 u16addr, uint8 *data, uint8 length,
+                        void (*callback)(TWI_TransactionType *transaction));
+
+/*
+ * Function: EEPROM_getAsyncResult
+ * -------------------------------
+ * Takes the result of a finished EEPROM_writeAsync and records it for
+ * EEPROM_getLastError like the result of a blocking call.
+ *
+ *  transaction: Descriptor of the write, no longer pending.
+ *
+ *  returns: SUCCESS if the EEPROM stored the bytes, ERROR otherwise.
+ */
+uint8 EEPROM_getAsyncResult(const TWI_TransactionType *transaction);
+
+/*
+ * Function: EEPROM_getLastError
+ * -----------------------------
+ * Tells whether the last EEPROM access on the bus failed and why,
+ * so the caller can tell a busy or missing EEPROM (TWI_ERROR_ADDRESS) from
+ * a stuck bus (the _TIMEOUT codes) and retry later. Every blocking call
+ * releases the bus before it returns, also on an error, and none waits
+ * longer than its TWI timeouts. Argument errors are not recorded.
+ *
+ *  returns: The TWI error of the last access, TWI_OK if it succeeded.
+ *           A later successful access clears an earlier error.
+ */
+TWI_ErrorType EEPROM_getLastError(void);
  
 #endif /* EXTERNAL_EEPROM_H_ */
@@ -5,59 +5,49 @@
  *      Author: Fatma Foley
  */
 
-#ifndef EXTERNAL_EEPROM_H_
-#define EXTERNAL_EEPROM_H_
-
-#include "std_types.h"
-
-/*******************************************************************************
- *                      Preprocessor Macros                                    *
- *******************************************************************************/
-/* Macros to indicate operation status */
-#define ERROR 0
-#define SUCCESS 1
+#include "icu.h"
+#include "common_macros.h" /* To use the macros like SET_BIT */
+#include <avr/io.h> /* To use ICU/Timer1 Registers */
+#include <avr/interrupt.h> /* For ICU ISR */
 
 /*******************************************************************************
- *                      Functions Prototypes                                   *
+ *                           Global Variables                                  *
  *******************************************************************************/
 
-/*
- * Function: EEPROM_writeByte
- * --------------------------
- * Writes a byte of data to the external EEPROM at the specified address.
- *
- *  u16addr: The 16-bit address in EEPROM to write the data byte.
- *  u8data: The data byte to be written.
- *
- *  returns: SUCCESS if the write operation was successful, ERROR otherwise.
- */
-uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
+/* Global variables to hold the address of the call back function in the application */
+static void (*volatile g_callBackPtr)(void) = NULL_PTR;
+static void (*volatile g_timeoutCallBackPtr)(void) = NULL_PTR;
 
-/*
- * Function: EEPROM_readByte
- * -------------------------
- * Reads a byte of data from the external EEPROM at the specified address.
- *
- *  u16addr: The 16-bit address in EEPROM to read the data byte.
- *  u8data: Pointer to a variable where the read data will be stored.
- *
- *  returns: SUCCESS if the read operation was successful, ERROR otherwise.
- */
-uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
+/* Timer1 overflows since Icu_init, the upper 16 bits of the timestamps */
+static volatile uint16 g_overflowCount = 0;
 
-#endif /* EXTERNAL_EEPROM_H_ */
+/* Extended time of the last captured edge */
+static volatile uint32 g_captureTime = 0;
 
-#include "icu.h"
-#include "common_macros.h" /* To use the macros like SET_BIT */
-#include <avr/io.h> /* To use ICU/Timer1 Registers */
-#include <avr/interrupt.h> /* For ICU ISR */
+/* Extended time at which the started timeout expires */
+static volatile uint32 g_timeoutTime = 0;
 
 /*******************************************************************************
- *                           Global Variables                                  *
+ *                      Private Functions Definitions                          *
  *******************************************************************************/
 
-/* Global variables to hold the address of the call back function in the application */
-static volatile void (*g_callBackPtr)(void) = NULL_PTR;
+/*
+ * Description: Extends a Timer1 value read with the interrupts disabled to
+ *              32 bits. An overflow still pending (TOV1 set) belongs to the
+ *              value only if the counter wrapped before it, that is if the
+ *              value is in the lower half.
+ */
+static uint32 Icu_extendTime(uint16 timer_value)
+{
+	uint16 overflows = g_overflowCount;
+
+	if((TIFR & (1<<TOV1)) && (timer_value < 0x8000))
+	{
+		overflows++;
+	}
+
+	return ((uint32)overflows << 16) | timer_value;
+}
 
 /*******************************************************************************
  *                       Interrupt Service Routines                            *
@@ -65,6 +55,9 @@ static volatile void (*g_callBackPtr)(void) = NULL_PTR;
 
 ISR(TIMER1_CAPT_vect)
 {
+	/* The capture interrupt has priority over the overflow one, Icu_extendTime accounts for it */
+	g_captureTime = Icu_extendTime(ICR1);
+
 	if(g_callBackPtr != NULL_PTR)
 	{
 		/* Call the Call Back function in the application after the edge is detected */
@@ -72,6 +65,28 @@ ISR(TIMER1_CAPT_vect)
 	}
 }
 
+ISR(TIMER1_COMPA_vect)
+{
+	/* A longer timeout matches once per Timer1 period before it expires */
+	if((sint32)(Icu_extendTime(TCNT1) - g_timeoutTime) < 0)
+	{
+		return;
+	}
+
+	/* One shot: the timeout is over once it fired */
+	TIMSK &= ~(1<<OCIE1A);
+
+	if(g_timeoutCallBackPtr != NULL_PTR)
+	{
+		(*g_timeoutCallBackPtr)();
+	}
+}
+
+ISR(TIMER1_OVF_vect)
+{
+	g_overflowCount++;
+}
+
 /*******************************************************************************
  *                      Functions Definitions                                  *
  *******************************************************************************/
@@ -99,15 +114,21 @@ void Icu_init(const Icu_ConfigType * Config_Ptr)
      * insert the required edge type in ICES1 bit in TCCR1B Register
 	 */
 	TCCR1B = (TCCR1B & 0xBF) | ((Config_Ptr->edge)<<6);
+	TIFR = (1<<ICF1);
 
-	/* Initial Value for Timer1 */
+	/* Initial Value for Timer1, it runs freely from here */
 	TCNT1 = 0;
+	g_overflowCount = 0;
+	TIFR = (1<<TOV1);
 
 	/* Initial Value for the input capture register */
 	ICR1 = 0;
 
-	/* Enable the Input Capture interrupt to generate an interrupt when edge is detected on ICP1/PD6 pin */
-	TIMSK |= (1<<TICIE1);
+	/*
+	 * Enable the Input Capture interrupt to generate an interrupt when edge is detected on ICP1/PD6 pin
+	 * and the overflow interrupt to count the upper 16 bits of the timestamps
+	 */
+	TIMSK |= (1<<TICIE1) | (1<<TOIE1);
 }
 
 /*
@@ -121,6 +142,7 @@ void Icu_setCallBack(void(*a_ptr)(void))
 
 /*
  * Description: Function to set the required edge detection.
+ * 	Changing the edge can raise a capture of its own, so the flag is cleared after.
  */
 void Icu_setEdgeDetectionType(const Icu_EdgeType a_edgeType)
 {
@@ -128,6 +150,7 @@ void Icu_setEdgeDetectionType(const Icu_EdgeType a_edgeType)
 	 * insert the required edge type in ICES1 bit in TCCR1B Register
 	 */
 	TCCR1B = (TCCR1B & 0xBF) | (a_edgeType<<6);
+	TIFR = (1<<ICF1);
 }
 
 /*
@@ -140,11 +163,36 @@ uint16 Icu_getInputCaptureValue(void)
 }
 
 /*
- * Description: Function to clear the Timer1 Value to start count from ZERO
+ * Description: Function to get the time of the last captured edge, the
+ *              ICR1 value extended to 32 bits with the Timer1 overflows.
  */
-void Icu_clearTimerValue(void)
+uint32 Icu_getCaptureTime(void)
 {
-	TCNT1 = 0;
+	uint32 time;
+	uint8 sreg = SREG;
+
+	CLEAR_BIT(SREG, 7);
+	time = g_captureTime;
+	SREG = sreg;
+
+	return time;
+}
+
+/*
+ * Description: Function to get the current time, TCNT1 extended to 32 bits
+ *              with the Timer1 overflows.
+ */
+uint32 Icu_getTime(void)
+{
+	uint32 time;
+	uint8 sreg = SREG;
+
+	/* The overflow interrupt must not run between the reads of TCNT1 and the count */
+	CLEAR_BIT(SREG, 7);
+	time = Icu_extendTime(TCNT1);
+	SREG = sreg;
+
+	return time;
 }
 
 /*
@@ -158,6 +206,45 @@ void Icu_DeInit(void)
 	TCNT1 = 0;
 	ICR1 = 0;
 
-	/* Disable the Input Capture interrupt */
-	TIMSK &= ~(1<<TICIE1);
+	/* Disable the Input Capture, timeout and overflow interrupts */
+	TIMSK &= ~((1<<TICIE1) | (1<<OCIE1A) | (1<<TOIE1));
+}
+
+/*
+ * Description: Function to set the Call Back function called when a
+ *              timeout started by Icu_startTimeout expires.
+ */
+void Icu_setTimeoutCallBack(void(*a_ptr)(void))
+{
+	g_timeoutCallBackPtr = a_ptr;
+}
+
+/*
+ * Description: Function to start a one shot timeout of ticks Timer1 counts
+ *              from now with the Output Compare A interrupt.
+ *              The compare matches the lower 16 bits of the expiry time,
+ *              the interrupt checks the whole time.
+ */
+void Icu_startTimeout(uint32 ticks)
+{
+	uint8 sreg = SREG;
+
+	CLEAR_BIT(SREG, 7);
+	g_timeoutTime = Icu_extendTime(TCNT1) + ticks;
+
+	/* Timer1 runs in Normal Mode, the compare match wraps with the counter */
+	OCR1A = (uint16)g_timeoutTime;
+
+	/* Drop a match left over from an earlier timeout, then enable the interrupt */
+	TIFR = (1<<OCF1A);
+	TIMSK |= (1<<OCIE1A);
+	SREG = sreg;
+}
+
+/*
+ * Description: Function to cancel the timeout.
+ */
+void Icu_stopTimeout(void)
+{
+	TIMSK &= ~(1<<OCIE1A);
 }
@@ -5,49 +5,6 @@
  *      Author: Fatma Foley
  */
 
-#ifndef EXTERNAL_EEPROM_H_
-#define EXTERNAL_EEPROM_H_
-
-#include "std_types.h"
-
-/*******************************************************************************
- *                      Preprocessor Macros                                    *
- *******************************************************************************/
-/* Macros to indicate operation status */
-#define ERROR 0
-#define SUCCESS 1
-
-/*******************************************************************************
- *                      Functions Prototypes                                   *
- *******************************************************************************/
-
-/*
- * Function: EEPROM_writeByte
- * --------------------------
- * Writes a byte of data to the external EEPROM at the specified address.
- *
- *  u16addr: The 16-bit address in EEPROM to write the data byte.
- *  u8data: The data byte to be written.
- *
- *  returns: SUCCESS if the write operation was successful, ERROR otherwise.
- */
-uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
-
-/*
- * Function: EEPROM_readByte
- * -------------------------
- * Reads a byte of data from the external EEPROM at the specified address.
- *
- *  u16addr: The 16-bit address in EEPROM to read the data byte.
- *  u8data: Pointer to a variable where the read data will be stored.
- *
- *  returns: SUCCESS if the read operation was successful, ERROR otherwise.
- */
-uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
-
-#endif /* EXTERNAL_EEPROM_H_ */
-
-
 #ifndef ICU_H_
 #define ICU_H_
 
@@ -91,6 +48,7 @@ void Icu_setCallBack(void(*a_ptr)(void));
 
 /*
  * Description: Function to set the required edge detection.
+ *              A capture pending from the old edge is dropped.
  */
 void Icu_setEdgeDetectionType(const Icu_EdgeType edgeType);
 
@@ -101,13 +59,40 @@ void Icu_setEdgeDetectionType(const Icu_EdgeType edgeType);
 uint16 Icu_getInputCaptureValue(void);
 
 /*
- * Description: Function to clear the Timer1 Value to start count from ZERO
+ * Description: Function to get the time of the last captured edge, the
+ *              ICR1 value extended to 32 bits with the Timer1 overflows.
+ *              Valid in the Call Back function of the edge.
  */
-void Icu_clearTimerValue(void);
+uint32 Icu_getCaptureTime(void);
+
+/*
+ * Description: Function to get the current time, TCNT1 extended to 32 bits
+ *              with the Timer1 overflows. Timer1 runs freely since Icu_init,
+ *              so differences of these timestamps measure any interval.
+ */
+uint32 Icu_getTime(void);
 
 /*
  * Description: Function to disable the Timer1 to stop the ICU Driver
  */
 void Icu_DeInit(void);
 
+/*
+ * Description: Function to set the Call Back function called when a
+ *              timeout started by Icu_startTimeout expires.
+ */
+void Icu_setTimeoutCallBack(void(*a_ptr)(void));
+
+/*
+ * Description: Function to start a one shot timeout of ticks Timer1 counts
+ *              from now with the Output Compare A interrupt.
+ *              Timeouts longer than one Timer1 period are supported.
+ */
+void Icu_startTimeout(uint32 ticks);
+
+/*
+ * Description: Function to cancel the timeout.
+ */
+void Icu_stopTimeout(void);
+
 #endif /* ICU_H_ */
@@ -0,0 +1,281 @@
+/*
+ * link_transfer.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "link_transfer.h"
+#include "link_frame.h"
+#include "systick.h"
+#include "uart.h"
+
+/*******************************************************************************
+ *                           Compile Time Checks                               *
+ *******************************************************************************/
+
+#if (LINK_TRANSFER_WINDOW < 1) || (LINK_TRANSFER_WINDOW > 8)
+#error "LINK_TRANSFER_WINDOW must be between 1 and 8 (receive bitmap is one byte)"
+#endif
+
+#if (LINK_TRANSFER_BLOCK_SIZE > LINK_FRAME_MAX_PAYLOAD)
+#error "LINK_TRANSFER_BLOCK_SIZE does not fit in a frame payload"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Sequence number of the START frame, changes per transfer so back to back
+ * transfers are not taken for retransmissions of each other */
+static uint8 g_transferSeq = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Maps an 8-bit sequence number back to a block index near base.
+ * Returns a value below base for sequence numbers that are behind it.
+ */
+static uint16 LinkTransfer_seqToIndex(uint16 base, uint8 seq)
+{
+    uint8 distance = (uint8)(seq - (uint8)base);
+
+    /* Anything more than half the sequence space ahead is an old block */
+    if(distance >= 128)
+    {
+        return base - (uint8)((uint8)base - seq);
+    }
+
+    return base + distance;
+}
+
+/*
+ * Description :
+ * Returns the number of data bytes of block index, only the last block is short.
+ */
+static uint8 LinkTransfer_blockLength(uint16 index, uint16 total_length)
+{
+    uint16 offset = index * LINK_TRANSFER_BLOCK_SIZE;
+
+    if((total_length - offset) < LINK_TRANSFER_BLOCK_SIZE)
+    {
+        return (uint8)(total_length - offset);
+    }
+
+    return LINK_TRANSFER_BLOCK_SIZE;
+}
+
+/*
+ * Description :
+ * Reads block index from the source and sends it, no copy is kept because a
+ * retransmission simply reads the block again.
+ */
+static boolean LinkTransfer_sendBlock(uint16 index, uint16 total_length, LinkTransfer_ReadType read)
+{
+    uint8 data[LINK_TRANSFER_BLOCK_SIZE];
+    uint16 offset = index * LINK_TRANSFER_BLOCK_SIZE;
+    uint8 length = LinkTransfer_blockLength(index, total_length);
+
+    if(!read(offset, data, length))
+    {
+        return FALSE;
+    }
+
+    LinkFrame_send(LINK_FRAME_TYPE_BULK_BLOCK, (uint8)index, data, length);
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Sender side: keeps the window full, slides it on cumulative ACKs and
+ * resends only the block named by a NACK or the oldest block on a timeout.
+ */
+boolean LinkTransfer_send(uint16 total_length, LinkTransfer_ReadType read)
+{
+    LinkFrame_Type frame;
+    uint8 start_payload[2];
+    uint16 block_count = (total_length + LINK_TRANSFER_BLOCK_SIZE - 1) / LINK_TRANSFER_BLOCK_SIZE;
+    uint16 base = 0, next = 0, index;
+    uint8 retries = 0;
+    uint32 base_sent_ms = 0;
+
+    /* Announce the length, the receiver needs it to know when it is done */
+    start_payload[0] = (uint8)(total_length >> 8);
+    start_payload[1] = (uint8)total_length;
+    g_transferSeq++;
+    if(!LinkFrame_sendReliable(LINK_FRAME_TYPE_BULK_START, g_transferSeq, start_payload, 2))
+    {
+        return FALSE;
+    }
+
+    while(base < block_count)
+    {
+        /* Fill the window */
+        while((next < block_count) && ((next - base) < LINK_TRANSFER_WINDOW))
+        {
+            if(!LinkTransfer_sendBlock(next, total_length, read))
+            {
+                return FALSE;
+            }
+            if(next == base)
+            {
+                base_sent_ms = Systick_getMs();
+            }
+            next++;
+        }
+
+        if(LinkFrame_poll(&frame))
+        {
+            index = LinkTransfer_seqToIndex(base, frame.seq);
+
+            if((frame.type == LINK_FRAME_TYPE_WINDOW_ACK) && (index > base) && (index <= next))
+            {
+                /* Cumulative ACK: everything below index arrived */
+                UART_recordAckWait((uint16)(Systick_getMs() - base_sent_ms));
+                base = index;
+                retries = 0;
+                base_sent_ms = Systick_getMs();
+            }
+            else if((frame.type == LINK_FRAME_TYPE_BULK_NACK) && (index >= base) && (index < next))
+            {
+                /* Selective retransmit of the missing block only */
+                UART_recordRetransmit();
+                if(!LinkTransfer_sendBlock(index, total_length, read))
+                {
+                    return FALSE;
+                }
+                if(index == base)
+                {
+                    base_sent_ms = Systick_getMs();
+                }
+            }
+        }
+        else if(Systick_isElapsed(base_sent_ms, LINK_FRAME_ACK_TIMEOUT_MS))
+        {
+            /* No progress: the oldest block or its ACK was lost */
+            if(retries >= LINK_FRAME_MAX_RETRIES)
+            {
+                return FALSE;
+            }
+            retries++;
+            UART_recordRetransmit();
+            if(!LinkTransfer_sendBlock(base, total_length, read))
+            {
+                return FALSE;
+            }
+            base_sent_ms = Systick_getMs();
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Receiver side: accepts blocks anywhere inside the window, tracks them in a
+ * bitmap, acknowledges cumulatively and asks once per gap for the missing block.
+ */
+boolean LinkTransfer_receive(uint16 *total_length, LinkTransfer_WriteType write)
+{
+    LinkFrame_Type frame;
+    uint16 block_count;
+    uint16 expected = 0, index, nack_sent_for = 0xFFFF;
+    uint8 start_seq;
+    uint8 received = 0; /* Bit n set: block expected + n already stored */
+    uint32 last_frame_ms;
+    uint32 done_ms = 0;
+
+    if(!LinkFrame_receiveReliable(LINK_FRAME_TYPE_BULK_START, &frame, LINK_FRAME_SESSION_TIMEOUT_MS))
+    {
+        return FALSE;
+    }
+    start_seq = frame.seq;
+    *total_length = ((uint16)frame.payload[0] << 8) | frame.payload[1];
+    block_count = (*total_length + LINK_TRANSFER_BLOCK_SIZE - 1) / LINK_TRANSFER_BLOCK_SIZE;
+    last_frame_ms = Systick_getMs();
+
+    while(1)
+    {
+        if(expected >= block_count)
+        {
+            /* Stay a little longer in case the last ACK was lost */
+            if(Systick_isElapsed(done_ms, LINK_TRANSFER_LINGER_MS))
+            {
+                return TRUE;
+            }
+        }
+        else if(Systick_isElapsed(last_frame_ms, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            return FALSE;
+        }
+
+        if(!LinkFrame_poll(&frame))
+        {
+            continue;
+        }
+
+        if(frame.type == LINK_FRAME_TYPE_BULK_START)
+        {
+            /*
+             * Same START again: its ACK was lost, the sender is still asking.
+             * A new START is left unanswered, the sender repeats it after
+             * this transfer returned.
+             */
+            if(frame.seq == start_seq)
+            {
+                LinkFrame_sendAck(frame.seq);
+            }
+            continue;
+        }
+        if(frame.type != LINK_FRAME_TYPE_BULK_BLOCK)
+        {
+            continue;
+        }
+        last_frame_ms = Systick_getMs();
+
+        index = LinkTransfer_seqToIndex(expected, frame.seq);
+        if((index >= expected) && (index < (expected + LINK_TRANSFER_WINDOW)) && (index < block_count))
+        {
+            /* A block of the wrong length is not stored, the sender sends it again */
+            if(frame.length != LinkTransfer_blockLength(index, *total_length))
+            {
+                LinkFrame_send(LINK_FRAME_TYPE_BULK_NACK, frame.seq, NULL_PTR, 0);
+                continue;
+            }
+
+            if(!(received & (1 << (index - expected))))
+            {
+                write(index * LINK_TRANSFER_BLOCK_SIZE, frame.payload, frame.length);
+                received |= (1 << (index - expected));
+            }
+
+            /* Slide over every block that is now complete */
+            while(received & 0x01)
+            {
+                received >>= 1;
+                expected++;
+            }
+
+            if(received != 0)
+            {
+                /* A later block arrived first, ask for the gap once */
+                if(nack_sent_for != expected)
+                {
+                    nack_sent_for = expected;
+                    LinkFrame_send(LINK_FRAME_TYPE_BULK_NACK, (uint8)expected, NULL_PTR, 0);
+                }
+            }
+
+            if(expected >= block_count)
+            {
+                done_ms = Systick_getMs();
+            }
+        }
+
+        /* Cumulative ACK, also answers duplicates of blocks already stored */
+        LinkFrame_send(LINK_FRAME_TYPE_WINDOW_ACK, (uint8)expected, NULL_PTR, 0);
+    }
+}
@@ -8,241 +8,574 @@
  */
 
 #include "uart.h"
+#include "link_frame.h"
+#include "link_transfer.h"
 #include "lm35_temp_sensor.h"
 #include "ultrasonic_sensor.h"
 #include "external_eeprom.h"
 #include "common_macros.h"
 #include "motor.h"
 #include "twi.h"
+#include "systick.h"
+#include "dtc_store.h"
 #include <util/delay.h>
 #include <avr/io.h>
 
-#define ERROR_TEMP_HIGH_ADDR  0x10  // EEPROM address for temperature error counter
-#define ERROR_DIST_LOW_ADDR   0x20  // EEPROM address for distance error counter
+/* Command keys sent by the HMI ECU */
+#define COMMAND_START_OPERATION   1
+#define COMMAND_DISPLAY_VALUES    2
+#define COMMAND_RETRIEVE_FAULTS   3
+#define COMMAND_STOP_MONITORING   4
+#define COMMAND_LINK_STATS        5
+#define COMMAND_EEPROM_DUMP       6
+#define COMMAND_GET_ALL           7
+#define COMMAND_SUBSCRIBE         8
+
+/* Push subscription used when the HMI does not send its own settings */
+#define PUSH_DEFAULT_TEMP_DEADBAND      1       /* C */
+#define PUSH_DEFAULT_DISTANCE_DEADBAND  2       /* cm */
+#define PUSH_DEFAULT_MAX_INTERVAL_MS    2000
+
+/* Sensor sampling period while a push subscription is active */
+#define PUSH_SAMPLE_PERIOD_MS           50
+
+/* Command wait slice, the fault counters are flushed between slices */
+#define COMMAND_IDLE_POLL_MS            100
+
+/* Longest wait for the next freeze request while the HMI browses the log */
+#define FREEZE_BROWSE_TIMEOUT_MS        30000
+
+/* One entry of the command dispatch table */
+typedef struct {
+    uint8 key;                  /* Command key received from the HMI */
+    void (*handler)(void);      /* Runs the whole command session */
+} Command_EntryType;
+
+/* Previous sensor values shared by all commands */
+static uint8 g_tempPrev = 0;
+static uint16 g_distancePrev = 0;
+
+/* Last commanded state of each window, part of every freeze-frame */
+static uint8 g_windowState[2] = {Stop, Stop};
+
+/* Sequence number of the next acknowledged frame */
+static uint8 g_frameSeq = 0;
+
+/*
+ * Description :
+ * Bulk transfer source for the EEPROM dump, reads length bytes at offset.
+ */
+static boolean Dump_readEeprom(uint16 offset, uint8 *data, uint8 length)
+{
+    /* One sequential read per block instead of one transaction per byte */
+    return (EEPROM_readBlock(offset, data, length) == SUCCESS);
+}
+
+/*
+ * Description :
+ * Rotates a window motor from its buttons and remembers the new state.
+ */
+static uint8 Window_rotate(Window_ID window)
+{
+    g_windowState[window] = DcMotor_Rotate(window);
+    return g_windowState[window];
+}
+
+/*
+ * Description :
+ * Counts a new over temperature (P002) or too close (P001) event. An event
+ * is only counted when the value changed since the last sample, and is
+ * logged with the sensor values and window states of this sample. The store
+ * writes the counters back to EEPROM once they are old enough.
+ */
+static void Faults_update(uint8 temp, uint16 distance)
+{
+    DtcStore_FreezeFrameType freeze_frame;
+
+    freeze_frame.temperature = temp;
+    freeze_frame.distance = distance;
+    freeze_frame.window1_state = g_windowState[WINDOW_1];
+    freeze_frame.window2_state = g_windowState[WINDOW_2];
+
+    if(temp > 90 && temp != g_tempPrev)
+    {
+        DtcStore_increment(DTC_P002_TEMP_HIGH, &freeze_frame);
+    }
+    if(distance < 10 && distance != g_distancePrev)
+    {
+        DtcStore_increment(DTC_P001_DIST_LOW, &freeze_frame);
+    }
+    DtcStore_service(FALSE);
+
+    /* Save previous values for next comparison */
+    g_tempPrev = temp;
+    g_distancePrev = distance;
+}
+
+/*
+ * Description :
+ * Copies both error counters into faults (P001, P002), followed by the
+ * result of the last EEPROM access, 0 once an access succeeded again, so
+ * the HMI can show why the log is not written.
+ */
+static void Faults_read(uint8 *faults)
+{
+    faults[DTC_P001_DIST_LOW] = DtcStore_get(DTC_P001_DIST_LOW);
+    faults[DTC_P002_TEMP_HIGH] = DtcStore_get(DTC_P002_TEMP_HIGH);
+    faults[DTC_COUNT] = (uint8)EEPROM_getLastError();
+}
+
+/*
+ * Description :
+ * Answers the freeze requests of the HMI with the logged events until it
+ * sends LINK_FRAME_FREEZE_DONE or goes silent. An index past the oldest
+ * event gets an empty freeze-frame.
+ */
+static void Faults_browse(void)
+{
+    uint8 index, length;
+    uint8 payload[LINK_FRAME_FREEZE_FRAME_SIZE];
+    DtcStore_RecordType record;
+    LinkFrame_FreezeFrameType freeze_frame;
+
+    while(LinkFrame_receiveValue(LINK_FRAME_TYPE_FREEZE_REQUEST, &index, FREEZE_BROWSE_TIMEOUT_MS) &&
+          (index != LINK_FRAME_FREEZE_DONE))
+    {
+        length = 0;
+        if(DtcStore_readEvent(index, &record))
+        {
+            freeze_frame.dtc = record.id;
+            freeze_frame.index = index;
+            freeze_frame.count = record.count[record.id];
+            freeze_frame.temperature = record.freeze_frame.temperature;
+            freeze_frame.distance = record.freeze_frame.distance;
+            freeze_frame.window1_state = record.freeze_frame.window1_state;
+            freeze_frame.window2_state = record.freeze_frame.window2_state;
+            freeze_frame.since_last_s = record.since_last_s;
+            freeze_frame.uptime_s = record.uptime_s;
+            LinkFrame_packFreezeFrame(&freeze_frame, payload);
+            length = LINK_FRAME_FREEZE_FRAME_SIZE;
+        }
+
+        LinkFrame_sendReliable(LINK_FRAME_TYPE_FREEZE_FRAME, g_frameSeq, payload, length);
+        g_frameSeq++;
+    }
+}
+
+/*
+ * Description :
+ * Command 1: collect sensor data and update error counters until the HMI
+ * sends tick 5.
+ */
+static void Command_startOperation(void)
+{
+    uint8 tick = 0, temp;
+    uint16 distance;
+    uint32 last_tick_ms = Systick_getMs();
+
+    while(tick < 5)
+    {
+        /* Pick up the latest tick without stopping the sampling */
+        if(LinkFrame_receiveValue(LINK_FRAME_TYPE_TICK, &tick, 0))
+        {
+            last_tick_ms = Systick_getMs();
+        }
+        else if(Systick_isElapsed(last_tick_ms, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            /* HMI went silent, end the session instead of hanging */
+            break;
+        }
+
+        /* Read current temperature while the echo is on its way, then the distance */
+        Ultrasonic_startMeasurement();
+        temp = LM35_getTemperature();
+        distance = Ultrasonic_readDistance();
+
+        _delay_ms(100);
+
+        Faults_update(temp, distance);
+    }
+}
+
+/*
+ * Description :
+ * Command 2: continuous monitoring and controlling motor state, one
+ * telemetry frame per tick, repeated while the HMI answers yes.
+ */
+static void Command_displayValues(void)
+{
+    uint8 tick = 0, repeat = 1, tick_loop_counter = 0, temp;
+    uint8 payload[LINK_FRAME_TELEMETRY_SIZE];
+    uint16 distance;
+    LinkFrame_TelemetryType telemetry;
+
+    while(repeat)
+    {
+        /* A missing tick means the HMI is gone, end the session */
+        if(!LinkFrame_receiveValue(LINK_FRAME_TYPE_TICK, &tick, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            break;
+        }
+
+        while(tick < 5)
+        {
+            if(!LinkFrame_receiveValue(LINK_FRAME_TYPE_TICK, &tick, LINK_FRAME_SESSION_TIMEOUT_MS))
+            {
+                repeat = 0;
+                break;
+            }
+            _delay_ms(200);
+
+            if(5 == tick)
+            {
+                break;
+            }
+
+            /* Get latest temperature and rotate motors/windows based on input while the echo is measured */
+            Ultrasonic_startMeasurement();
+            temp = LM35_getTemperature();
+            telemetry.window1_state = Window_rotate(WINDOW_1);
+            telemetry.window2_state = Window_rotate(WINDOW_2);
+            distance = Ultrasonic_readDistance();
+
+            /* Update error counters if thresholds exceeded and values changed */
+            Faults_update(temp, distance);
+            if(tick_loop_counter > 0)
+            {
+                _delay_ms(100);
+            }
+            tick_loop_counter++;
+
+            /* Send the whole snapshot in one telemetry frame, acknowledged once */
+            telemetry.temperature = temp;
+            telemetry.distance = distance;
+            telemetry.dist_error_counter = DtcStore_get(DTC_P001_DIST_LOW);
+            telemetry.temp_error_counter = DtcStore_get(DTC_P002_TEMP_HIGH);
+            LinkFrame_packTelemetry(&telemetry, payload);
+            LinkFrame_sendReliable(LINK_FRAME_TYPE_TELEMETRY, g_frameSeq, payload, LINK_FRAME_TELEMETRY_SIZE);
+            g_frameSeq++;
+        }
+
+        /* Check for repeat command, silence counts as no */
+        if(repeat && !LinkFrame_receiveValue(LINK_FRAME_TYPE_REPEAT, &repeat, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            repeat = 0;
+        }
+        _delay_ms(200);
+
+        tick_loop_counter = 0;
+    }
+}
+
+/*
+ * Description :
+ * Command 3: send the error counters stored in EEPROM once per tick while
+ * still checking the sensors, repeated while the HMI answers yes. The
+ * answer LINK_FRAME_REPEAT_FREEZE_FRAMES ends the session with freeze-frame
+ * browsing instead.
+ */
+static void Command_retrieveFaults(void)
+{
+    uint8 tick = 0, repeat = 1;
+    uint8 faults[LINK_FRAME_FAULTS_SIZE];
+
+    while(repeat)
+    {
+        /* A missing tick means the HMI is gone, end the session */
+        if(!LinkFrame_receiveValue(LINK_FRAME_TYPE_TICK, &tick, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            break;
+        }
+
+        while(tick < 5)
+        {
+            if(!LinkFrame_receiveValue(LINK_FRAME_TYPE_TICK, &tick, LINK_FRAME_SESSION_TIMEOUT_MS))
+            {
+                repeat = 0;
+                break;
+            }
+
+            if(5 == tick)
+            {
+                break;
+            }
+
+            /* Take the error counters, then check the sensors */
+            Faults_read(faults);
+            Faults_update(LM35_getTemperature(), Ultrasonic_readDistance());
+
+            /* Send both error counters in one frame and wait for its ACK */
+            LinkFrame_sendReliable(LINK_FRAME_TYPE_FAULTS, g_frameSeq, faults, LINK_FRAME_FAULTS_SIZE);
+            g_frameSeq++;
+        }
+
+        /* Check for repeat command, silence counts as no */
+        if(repeat && !LinkFrame_receiveValue(LINK_FRAME_TYPE_REPEAT, &repeat, LINK_FRAME_SESSION_TIMEOUT_MS))
+        {
+            repeat = 0;
+        }
+        if(LINK_FRAME_REPEAT_FREEZE_FRAMES == repeat)
+        {
+            /* The HMI wants the logged events, its requests follow right away */
+            Faults_browse();
+            break;
+        }
+        _delay_ms(200);
+    }
+}
+
+/*
+ * Description :
+ * Command 4: reset error counters and sensor previous values to zero.
+ */
+static void Command_stopMonitoring(void)
+{
+    g_tempPrev = 0;
+    g_distancePrev = 0;
+
+    /* Zero the counters in RAM and EEPROM right away */
+    DtcStore_clearAll();
+}
+
+/*
+ * Description :
+ * Command 5: diagnostic request, report the link statistics of this ECU.
+ */
+static void Command_linkStats(void)
+{
+    uint8 payload[LINK_FRAME_STATS_SIZE];
+    UART_StatsType link_stats;
+
+    UART_getStats(&link_stats);
+    LinkFrame_packStats(&link_stats, payload);
+    LinkFrame_sendReliable(LINK_FRAME_TYPE_STATS, g_frameSeq, payload, LINK_FRAME_STATS_SIZE);
+    g_frameSeq++;
+}
+
+/*
+ * Description :
+ * Command 6: dump the whole external EEPROM with the pipelined bulk transfer.
+ */
+static void Command_eepromDump(void)
+{
+    /* The dump must show the counters as they are in RAM */
+    DtcStore_flush();
+    LinkTransfer_send(EEPROM_SIZE, Dump_readEeprom);
+}
+
+/*
+ * Description :
+ * Command 7: one shot dashboard request. Samples the sensors and windows
+ * once and answers with a single telemetry frame carrying every live value
+ * and both error counters, no tick session needed.
+ */
+static void Command_getAll(void)
+{
+    uint8 payload[LINK_FRAME_TELEMETRY_SIZE];
+    LinkFrame_TelemetryType telemetry;
+
+    telemetry.temperature = LM35_getTemperature();
+    telemetry.distance = Ultrasonic_readDistance();
+    telemetry.window1_state = Window_rotate(WINDOW_1);
+    telemetry.window2_state = Window_rotate(WINDOW_2);
+    Faults_update(telemetry.temperature, telemetry.distance);
+    telemetry.dist_error_counter = DtcStore_get(DTC_P001_DIST_LOW);
+    telemetry.temp_error_counter = DtcStore_get(DTC_P002_TEMP_HIGH);
+
+    LinkFrame_packTelemetry(&telemetry, payload);
+    LinkFrame_sendReliable(LINK_FRAME_TYPE_TELEMETRY, g_frameSeq, payload, LINK_FRAME_TELEMETRY_SIZE);
+    g_frameSeq++;
+}
+
+/*
+ * Description :
+ * Returns the bitmask of the fields in current that differ from the values
+ * last pushed to the HMI, temperature and distance only beyond their deadband.
+ */
+static uint8 Push_changedFields(const LinkFrame_TelemetryType *current, const LinkFrame_TelemetryType *pushed,
+                                const LinkFrame_SubscribeType *subscribe)
+{
+    uint8 fields = 0;
+    uint8 temp_delta;
+    uint16 distance_delta;
+
+    temp_delta = (current->temperature > pushed->temperature) ?
+                 (current->temperature - pushed->temperature) : (pushed->temperature - current->temperature);
+    distance_delta = (current->distance > pushed->distance) ?
+                     (current->distance - pushed->distance) : (pushed->distance - current->distance);
+
+    if(temp_delta > subscribe->temperature_deadband)
+    {
+        fields |= LINK_FRAME_FIELD_TEMPERATURE;
+    }
+    if(distance_delta > subscribe->distance_deadband)
+    {
+        fields |= LINK_FRAME_FIELD_DISTANCE;
+    }
+    if(current->window1_state != pushed->window1_state)
+    {
+        fields |= LINK_FRAME_FIELD_WINDOW1;
+    }
+    if(current->window2_state != pushed->window2_state)
+    {
+        fields |= LINK_FRAME_FIELD_WINDOW2;
+    }
+    if(current->dist_error_counter != pushed->dist_error_counter)
+    {
+        fields |= LINK_FRAME_FIELD_DIST_ERRORS;
+    }
+    if(current->temp_error_counter != pushed->temp_error_counter)
+    {
+        fields |= LINK_FRAME_FIELD_TEMP_ERRORS;
+    }
+
+    return fields;
+}
+
+/*
+ * Description :
+ * Command 8: push subscription. The HMI follows the command with a
+ * subscribe frame (defaults are used if it does not arrive). The ECU then
+ * keeps sampling and pushes only the fields that changed, or every field
+ * once max_interval_ms passed without a push. A repeat frame with 0, a new
+ * command or a push that is never acknowledged ends the subscription, the
+ * command is left for the dispatcher.
+ */
+static void Command_subscribe(void)
+{
+    uint8 payload[LINK_FRAME_MAX_PAYLOAD];
+    uint8 fields, length;
+    uint32 last_push_ms;
+    LinkFrame_Type frame;
+    LinkFrame_TelemetryType current, pushed;
+    LinkFrame_SubscribeType subscribe = {PUSH_DEFAULT_TEMP_DEADBAND, PUSH_DEFAULT_DISTANCE_DEADBAND,
+                                         PUSH_DEFAULT_MAX_INTERVAL_MS};
+
+    if(LinkFrame_receiveTimeout(&frame, LINK_FRAME_RESPONSE_TIMEOUT_MS) &&
+       (LINK_FRAME_TYPE_SUBSCRIBE == frame.type) && (frame.length >= LINK_FRAME_SUBSCRIBE_SIZE))
+    {
+        LinkFrame_unpackSubscribe(frame.payload, &subscribe);
+    }
+
+    /* The first push carries every field */
+    fields = LINK_FRAME_FIELD_ALL;
+    last_push_ms = Systick_getMs();
+
+    while(1)
+    {
+        if(LinkFrame_poll(&frame))
+        {
+            if((LINK_FRAME_TYPE_REPEAT == frame.type) && (frame.length > 0) && (0 == frame.payload[0]))
+            {
+                break;
+            }
+            if(LINK_FRAME_TYPE_COMMAND == frame.type)
+            {
+                /* The HMI moved on, the main loop runs its command next */
+                LinkFrame_putBack(&frame);
+                break;
+            }
+        }
+
+        /* The echo is measured by the ICU while the rest is sampled */
+        Ultrasonic_startMeasurement();
+        current.temperature = LM35_getTemperature();
+        current.window1_state = Window_rotate(WINDOW_1);
+        current.window2_state = Window_rotate(WINDOW_2);
+        current.distance = Ultrasonic_readDistance();
+        Faults_update(current.temperature, current.distance);
+        current.dist_error_counter = DtcStore_get(DTC_P001_DIST_LOW);
+        current.temp_error_counter = DtcStore_get(DTC_P002_TEMP_HIGH);
+
+        if(fields != LINK_FRAME_FIELD_ALL)
+        {
+            fields = Push_changedFields(&current, &pushed, &subscribe);
+        }
+        if(Systick_isElapsed(last_push_ms, subscribe.max_interval_ms))
+        {
+            fields = LINK_FRAME_FIELD_ALL;
+        }
+
+        if(fields != 0)
+        {
+            length = LinkFrame_packDelta(&current, fields, payload);
+            if(!LinkFrame_sendReliable(LINK_FRAME_TYPE_PUSH, g_frameSeq, payload, length))
+            {
+                /* HMI stopped acknowledging, end the subscription */
+                break;
+            }
+            g_frameSeq++;
+
+            /* Track exactly what the HMI shows, so slow drifts still cross the deadband */
+            LinkFrame_unpackDelta(payload, length, &pushed);
+            last_push_ms = Systick_getMs();
+            fields = 0;
+        }
+
+        _delay_ms(PUSH_SAMPLE_PERIOD_MS);
+    }
+}
+
+/* Command dispatch table, keys without an entry are ignored */
+static const Command_EntryType g_commandTable[] = {
+    {COMMAND_START_OPERATION,   Command_startOperation},
+    {COMMAND_DISPLAY_VALUES,    Command_displayValues},
+    {COMMAND_RETRIEVE_FAULTS,   Command_retrieveFaults},
+    {COMMAND_STOP_MONITORING,   Command_stopMonitoring},
+    {COMMAND_LINK_STATS,        Command_linkStats},
+    {COMMAND_EEPROM_DUMP,       Command_eepromDump},
+    {COMMAND_GET_ALL,           Command_getAll},
+    {COMMAND_SUBSCRIBE,         Command_subscribe}
+};
+
+#define COMMAND_TABLE_SIZE  (sizeof(g_commandTable) / sizeof(g_commandTable[0]))
 
 int main(void)
 {
     /* Variable declarations and initialization */
-    uint8 key = 0, tick = 0, temp_prev = 0, temp = 0, distance_high_byte = 0, distance_low_byte = 0;
-    uint8 P001_Dist_error_counter = 0, P002_Temp_error_counter = 0, repeat = 1;
-    uint8 eeprom_data = 0, faults_buffer[2] = {0,0}, tick_loop_counter = 0, check = 0;
-    uint16 distance_prev = 0, distance = 0;
-    DcMotor_State window1_state, window2_state;
+    uint8 key = 0, i;
 
-    /* UART configuration struct */
-    UART_ConfigType Config_Ptr = {BIT_DATA_8, PARITY_DISABLED, STOP_BIT_1, 9600};
+    /* UART configuration struct, both ECUs use the same link baud rate profile */
+    UART_ConfigType Config_Ptr = {BIT_DATA_8, PARITY_DISABLED, STOP_BIT_1, UART_LINK_BAUD_RATE, UART_NO_ADDRESS};
 
     /* Initialize sensors, UART, motor, and TWI */
     LM35_init();
     Ultrasonic_init();
     UART_init(&Config_Ptr);
     DcMotor_Init();
-    TWI_ConfigType twi_settings = {0x01, 400000};
+    Systick_init();
+    LinkFrame_init();
+    TWI_ConfigType twi_settings = {0x01, TWI_BIT_RATE_FAST};
 
-    /* Initialize TWI (I2C) */
+    /* Initialize TWI (I2C), a slave left holding SDA by a reset is clocked free first */
     TWI_init(&twi_settings);
 
     /* Enable global interrupts */
     SREG |= (1 << 7);
 
+    /* Load the fault counters once, the tick must be running for the EEPROM timeouts */
+    DtcStore_init();
+
     while(1)
     {
-        /* Receive command key from UART */
-        key = UART_recieveByte();
-
-        switch(key)
-        {
-            case 1:
-                /* In case 1: collect sensor data and update error counters */
-                while(tick < 5)
-                {
-                    tick = UART_recieveByte();
-
-                    /* Read current temperature and distance */
-                    temp = LM35_getTemperature();
-                    distance = Ultrasonic_readDistance();
-
-                    _delay_ms(100);
-
-                    /* Read current error counters from EEPROM */
-                    EEPROM_readByte(ERROR_DIST_LOW_ADDR, &eeprom_data);
-                    _delay_ms(10);
-                    P001_Dist_error_counter = eeprom_data;
-                    EEPROM_readByte(ERROR_TEMP_HIGH_ADDR, &eeprom_data);
-                    _delay_ms(10);
-                    P002_Temp_error_counter = eeprom_data;
-
-                    /* If temperature exceeds 90 and has changed, increment temp error counter */
-                    if(temp > 90 && temp != temp_prev)
-                    {
-                        P002_Temp_error_counter++;
-                        EEPROM_writeByte(ERROR_TEMP_HIGH_ADDR, P002_Temp_error_counter);
-                        _delay_ms(10);
-                    }
-
-                    /* If distance less than 10 and changed, increment distance error counter */
-                    if(distance < 10 && distance != distance_prev)
-                    {
-                        P001_Dist_error_counter++;
-                        EEPROM_writeByte(ERROR_DIST_LOW_ADDR, P001_Dist_error_counter);
-                        _delay_ms(10);
-                    }
-
-                    /* Save previous values for next comparison */
-                    temp_prev = temp;
-                    distance_prev = distance;
-                }
-                break;
-
-            case 2:
-                /* Case 2: continuous monitoring and controlling motor state with UART data exchange */
-                while(repeat)
-                {
-                    tick = UART_recieveByte();
-
-                    while(tick < 5)
-                    {
-                        tick = UART_recieveByte();
-                        _delay_ms(200);
-
-                        if(5 == tick)
-                        {
-                            break;
-                        }
-
-                        /* Get latest temperature and distance */
-                        temp = LM35_getTemperature();
-                        distance = Ultrasonic_readDistance();
-
-                        /* Split distance into high and low bytes for transmission */
-                        distance_high_byte = (distance >> 8);
-                        distance_low_byte = (distance & 0xFF);
-
-                        /* Rotate motors/windows based on input */
-                        window1_state = DcMotor_Rotate(WINDOW_1);
-                        window2_state = DcMotor_Rotate(WINDOW_2);
-
-                        /* Update error counters if thresholds exceeded and values changed */
-                        if(temp > 90 && temp != temp_prev)
-                        {
-                            P002_Temp_error_counter++;
-                            EEPROM_writeByte(ERROR_TEMP_HIGH_ADDR, P002_Temp_error_counter);
-                            _delay_ms(10);
-                        }
-                        if(distance < 10 && distance != distance_prev)
-                        {
-                            P001_Dist_error_counter++;
-                            EEPROM_writeByte(ERROR_DIST_LOW_ADDR, P001_Dist_error_counter);
-                            _delay_ms(10);
-                        }
-                        if(tick_loop_counter > 0)
-                        {
-                            _delay_ms(100);
-                        }
-                        tick_loop_counter++;
-
-                        /* Update previous values */
-                        temp_prev = temp;
-                        distance_prev = distance;
-
-                        /* Send latest sensor and motor state data through UART with ACK synchronization */
-                        UART_sendByte(temp);
-                        UART_waitForACK();
-                        UART_sendByte(distance_high_byte);
-                        UART_waitForACK();
-                        UART_sendByte(distance_low_byte);
-                        UART_waitForACK();
-                        UART_sendByte(window1_state);
-                        UART_waitForACK();
-                        UART_sendByte(window2_state);
-                    }
-
-                    /* Check for repeat command */
-                    repeat = UART_recieveByte();
-                    _delay_ms(200);
-
-                    tick_loop_counter = 0;
-                    check = 0;
-                }
-                tick = 0;
-                repeat = 1;
-                break;
-
-            case 3:
-                /* Case 3: send the error counters and basic sensors continuously */
-                check = 0;
-
-                while(repeat)
-                {
-                    tick = UART_recieveByte();
-
-                    while(tick < 5)
-                    {
-                        tick = UART_recieveByte();
-
-                        if(5 == tick)
-                        {
-                            break;
-                        }
-
-                        /* Read error counters from EEPROM */
-                        EEPROM_readByte(ERROR_DIST_LOW_ADDR, &eeprom_data);
-                        _delay_ms(10);
-                        faults_buffer[0] = eeprom_data;
-
-                        EEPROM_readByte(ERROR_TEMP_HIGH_ADDR, &eeprom_data);
-                        _delay_ms(10);
-                        faults_buffer[1] = eeprom_data;
-
-                        /* Read sensors */
-                        temp = LM35_getTemperature();
-                        distance = Ultrasonic_readDistance();
-
-                        /* Update error counters for threshold breaches */
-                        if(temp > 90 && temp != temp_prev)
-                        {
-                            P002_Temp_error_counter++;
-                            EEPROM_writeByte(ERROR_TEMP_HIGH_ADDR, P002_Temp_error_counter);
-                            _delay_ms(10);
-                        }
-                        if(distance < 10 && distance != distance_prev)
-                        {
-                            P001_Dist_error_counter++;
-                            EEPROM_writeByte(ERROR_DIST_LOW_ADDR, P001_Dist_error_counter);
-                            _delay_ms(10);
-                        }
-
-                        /* Update previous sensor values */
-                        temp_prev = temp;
-                        distance_prev = distance;
-
-                        /* Send error counters through UART and wait for ACK */
-                        UART_sendByte(faults_buffer[0]);
-                        UART_waitForACK();
-                        UART_sendByte(faults_buffer[1]);
-                    }
-
-                    repeat = UART_recieveByte();
-                    _delay_ms(200);
-                }
-
-                tick = 0;
-                repeat = 1;
-                break;
+        /*
+         * Receive command key from UART. Frames of other types are leftovers
+         * of a session that already timed out and are dropped.
+         */
+        while(!LinkFrame_receiveValue(LINK_FRAME_TYPE_COMMAND, &key, COMMAND_IDLE_POLL_MS))
+        {
+            /* Nothing to do, a good time to save the fault counters */
+            DtcStore_service(TRUE);
+        }
 
-            case 4:
-                /* Case 4: Reset error counters and sensor previous values to zero */
-                P001_Dist_error_counter = 0;
-                P002_Temp_error_counter = 0;
-                temp_prev = 0;
-                distance_prev = 0;
-
-                /* Write zero to EEPROM error counter addresses */
-                EEPROM_writeByte(ERROR_TEMP_HIGH_ADDR, 0);
-                _delay_ms(10);
-                EEPROM_writeByte(ERROR_DIST_LOW_ADDR, 0);
-                _delay_ms(10);
+        /* Run the handler of the received key */
+        for(i = 0; i < COMMAND_TABLE_SIZE; i++)
+        {
+            if(g_commandTable[i].key == key)
+            {
+                g_commandTable[i].handler();
                 break;
+            }
         }
     }
 }
@@ -0,0 +1,77 @@
+/*
+ * systick.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "systick.h"
+#include "common_macros.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Milliseconds since Systick_init */
+static volatile uint32 g_systickMs = 0;
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+/* Timer2 compare match every 1 ms */
+ISR(TIMER2_COMP_vect)
+{
+    g_systickMs++;
+}
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Timer2 is not used by any other driver on the Control ECU
+ * (Timer0 drives the PWM and Timer1 the ICU), so it owns it directly:
+ *  - CTC mode (WGM21=1, WGM20=0)
+ *  - Prescaler 64 (CS22=1, CS21=0, CS20=0)
+ *  - Compare match interrupt enabled
+ */
+void Systick_init(void)
+{
+    g_systickMs = 0;
+
+    TCNT2 = 0;
+    OCR2 = (uint8)SYSTICK_COMPARE_VALUE;
+    TCCR2 = (1<<FOC2) | (1<<WGM21) | (1<<CS22);
+
+    TIMSK |= (1<<OCIE2);
+}
+
+/*
+ * Description :
+ * Reads the 32-bit counter with the interrupts disabled so the ISR can not
+ * update it in the middle of the read.
+ */
+uint32 Systick_getMs(void)
+{
+    uint32 ms;
+    uint8 sreg = SREG;
+
+    CLEAR_BIT(SREG, 7);
+    ms = g_systickMs;
+    SREG = sreg;
+
+    return ms;
+}
+
+/*
+ * Description :
+ * Unsigned subtraction keeps the result correct when the counter wraps.
+ */
+boolean Systick_isElapsed(uint32 start_ms, uint32 timeout_ms)
+{
+    return ((Systick_getMs() - start_ms) >= timeout_ms) ? TRUE : FALSE;
+}
@@ -0,0 +1,45 @@
+/*
+ * systick.h
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#ifndef SYSTICK_H_
+#define SYSTICK_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* 8-bit timer in CTC mode: F_CPU/64 = 125 kHz, 125 counts = 1 ms */
+#define SYSTICK_PRESCALER    64UL
+#define SYSTICK_COMPARE_VALUE       ((F_CPU / SYSTICK_PRESCALER / 1000UL) - 1UL)
+
+/*******************************************************************************
+ *                              Functions Prototypes                           *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Starts the 1 ms system tick used for timeouts and deadlines.
+ * Global interrupts must be enabled for the tick to run.
+ */
+void Systick_init(void);
+
+/*
+ * Description :
+ * Returns the number of milliseconds since Systick_init (wraps after ~49 days).
+ */
+uint32 Systick_getMs(void);
+
+/*
+ * Description :
+ * Returns TRUE once timeout_ms milliseconds have passed since start_ms.
+ * Safe across the counter wrap around.
+ */
+boolean Systick_isElapsed(uint32 start_ms, uint32 timeout_ms);
+
+#endif /* SYSTICK_H_ */
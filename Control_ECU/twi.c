@@ -7,24 +7,463 @@
 
 
 #include "twi.h"
+#include "gpio.h"
+#include "systick.h"
 #include "common_macros.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
 
-void TWI_init(const TWI_ConfigType * Config_Ptr)
+/* Engine phases of the transaction on the bus */
+#define TWI_PHASE_WRITE  0 /* Sending SLA+W, header and write data */
+#define TWI_PHASE_READ   1 /* Sending SLA+R and receiving data */
+#define TWI_PHASE_POLL   2 /* Polling SLA+W until the slave is ready */
+
+/* Transaction queue, g_head is the one on the bus */
+static TWI_TransactionType * volatile g_head = NULL_PTR;
+static TWI_TransactionType * volatile g_tail = NULL_PTR;
+static volatile boolean g_engineActive = FALSE;
+
+/* Time the transaction at the head went on the bus */
+static volatile uint32 g_headStartMs = 0;
+
+/* Progress of the transaction on the bus */
+static volatile uint8 g_phase;
+static volatile uint8 g_headerIndex;
+static volatile uint8 g_dataIndex;
+static volatile uint8 g_pollsLeft;
+
+/* SCL frequency set up by TWI_init */
+static TWI_BaudRateType g_bitRate = 0;
+
+/*
+ * Description :
+ * Ends the transaction on the bus, calls its call back and starts the next
+ * queued transaction with a STOP followed by a START, or just sends STOP.
+ */
+static void TWI_finish(TWI_TransactionStatusType status, uint8 bus_status)
+{
+    TWI_TransactionType *done = g_head;
+
+    g_head = done->next;
+    if(NULL_PTR == g_head)
+    {
+        g_tail = NULL_PTR;
+    }
+    done->error_status = bus_status;
+    done->status = status;
+
+    /* The call back may queue the next transaction, the engine is still active */
+    if(done->callback != NULL_PTR)
+    {
+        done->callback(done);
+    }
+
+    if(g_head != NULL_PTR)
+    {
+        g_head->status = TWI_TRANSACTION_BUSY;
+        g_headStartMs = Systick_getMs();
+        g_phase = TWI_PHASE_WRITE;
+        g_headerIndex = 0;
+        g_dataIndex = 0;
+        g_pollsLeft = TWI_READY_POLL_LIMIT;
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+    }
+    else
+    {
+        g_engineActive = FALSE;
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+    }
+}
+
+/*
+ * Description :
+ * Sends the next header or data byte of the transaction on the bus, or moves
+ * on to the read, ready poll or end of the transaction.
+ */
+static void TWI_sendNext(void)
+{
+    TWI_TransactionType *transaction = g_head;
+
+    if(g_headerIndex < transaction->header_length)
+    {
+        TWDR = transaction->header[g_headerIndex++];
+        TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+    }
+    else if(TWI_READ == transaction->direction)
+    {
+        g_phase = TWI_PHASE_READ;
+        TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+    }
+    else if(g_dataIndex < transaction->length)
+    {
+        TWDR = transaction->data[g_dataIndex++];
+        TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+    }
+    else if(transaction->flags & TWI_FLAG_WAIT_READY)
+    {
+        /* STOP starts the slave's internal cycle, then poll its address */
+        g_phase = TWI_PHASE_POLL;
+        TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+    }
+    else
+    {
+        TWI_finish(TWI_TRANSACTION_DONE, TWI_MT_DATA_ACK);
+    }
+}
+
+/* TWI state machine, one step per bus event */
+ISR(TWI_vect)
+{
+    uint8 status = TWSR & 0xF8;
+    TWI_TransactionType *transaction = g_head;
+
+    switch(status)
+    {
+        case TWI_START:
+        case TWI_REP_START:
+            if((TWI_PHASE_READ == g_phase) || ((TWI_READ == transaction->direction) && (0 == transaction->header_length)))
+            {
+                g_phase = TWI_PHASE_READ;
+                TWDR = transaction->slave_address | 1;
+            }
+            else
+            {
+                TWDR = transaction->slave_address & 0xFE;
+            }
+            TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            break;
+
+        case TWI_MT_SLA_W_ACK:
+            if(TWI_PHASE_POLL == g_phase)
+            {
+                /* Slave answered, its write cycle is over */
+                TWI_finish(TWI_TRANSACTION_DONE, status);
+            }
+            else
+            {
+                TWI_sendNext();
+            }
+            break;
+
+        case TWI_MT_SLA_W_NACK:
+            if((TWI_PHASE_POLL == g_phase) && (g_pollsLeft > 0))
+            {
+                g_pollsLeft--;
+                TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+            }
+            else
+            {
+                TWI_finish(TWI_TRANSACTION_ERROR, status);
+            }
+            break;
+
+        case TWI_MT_DATA_ACK:
+            TWI_sendNext();
+            break;
+
+        case TWI_MT_SLA_R_ACK:
+            /* ACK every byte but the last one */
+            if(transaction->length > 1)
+            {
+                TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+            }
+            else
+            {
+                TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            }
+            break;
+
+        case TWI_MR_DATA_ACK:
+            transaction->data[g_dataIndex++] = TWDR;
+            if(g_dataIndex < (transaction->length - 1))
+            {
+                TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+            }
+            else
+            {
+                TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+            }
+            break;
+
+        case TWI_MR_DATA_NACK:
+            transaction->data[g_dataIndex++] = TWDR;
+            TWI_finish(TWI_TRANSACTION_DONE, status);
+            break;
+
+        default:
+            /* Data NACK, arbitration lost or bus error */
+            TWI_finish(TWI_TRANSACTION_ERROR, status);
+            break;
+    }
+}
+
+/*
+ * Description :
+ * Waits for TWINT, the end of the current bus event.
+ * Returns FALSE if it did not come within TWI_WAIT_TIMEOUT_US.
+ */
+static boolean TWI_waitInterrupt(void)
+{
+    uint16 waited_us;
+
+    for(waited_us = 0; BIT_IS_CLEAR(TWCR,TWINT); waited_us++)
+    {
+        if(waited_us >= TWI_WAIT_TIMEOUT_US)
+        {
+            return FALSE;
+        }
+        _delay_us(1);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Waits until a STOP is on the bus, a START must not overlap it.
+ * Returns FALSE if it is still pending after TWI_WAIT_TIMEOUT_US.
+ */
+static boolean TWI_waitStop(void)
+{
+    uint16 waited_us;
+
+    for(waited_us = 0; BIT_IS_SET(TWCR,TWSTO); waited_us++)
+    {
+        if(waited_us >= TWI_WAIT_TIMEOUT_US)
+        {
+            return FALSE;
+        }
+        _delay_us(1);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Cancels the queue if the transaction on the bus is past its deadline,
+ * its next TWINT is not coming any more.
+ */
+static void TWI_checkDeadline(void)
+{
+    boolean expired;
+    uint8 sreg = SREG;
+
+    CLEAR_BIT(SREG, 7);
+    expired = g_engineActive && Systick_isElapsed(g_headStartMs, TWI_TRANSACTION_TIMEOUT_MS);
+    SREG = sreg;
+
+    if(expired)
+    {
+        TWI_cancel();
+    }
+}
+
+/*
+ * Description :
+ * Waits until the interrupt driven engine finished its queue.
+ * Returns FALSE if it is still active after TWI_ENGINE_TIMEOUT_US.
+ */
+static boolean TWI_waitEngineIdle(void)
+{
+    uint16 waited;
+
+    for(waited = 0; TWI_isBusy(); waited++)
+    {
+        if(waited >= (TWI_ENGINE_TIMEOUT_US / 10))
+        {
+            return FALSE;
+        }
+        _delay_us(10);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Releases an open-drain bus line: input without pull-up, the bus
+ * resistor pulls it high unless a slave holds it low.
+ */
+static void TWI_releaseLine(uint8 port_num, uint8 pin_num)
+{
+    GPIO_setupPinDirection(port_num, pin_num, PIN_INPUT);
+    GPIO_writePin(port_num, pin_num, LOGIC_LOW);
+}
+
+/*
+ * Description :
+ * Pulls an open-drain bus line low.
+ */
+static void TWI_driveLineLow(uint8 port_num, uint8 pin_num)
+{
+    GPIO_writePin(port_num, pin_num, LOGIC_LOW);
+    GPIO_setupPinDirection(port_num, pin_num, PIN_OUTPUT);
+}
+
+/*
+ * Description :
+ * Waits until SCL is high, a slave may stretch the clock.
+ * Returns FALSE if it is still low after TWI_RECOVERY_STRETCH_US.
+ */
+static boolean TWI_waitSclHigh(void)
+{
+    uint16 waited_us;
+
+    for(waited_us = 0; waited_us < TWI_RECOVERY_STRETCH_US; waited_us++)
+    {
+        if(GPIO_readPin(TWI_SCL_PORT_ID, TWI_SCL_PIN_ID) == LOGIC_HIGH)
+        {
+            return TRUE;
+        }
+        _delay_us(1);
+    }
+
+    return FALSE;
+}
+
+boolean TWI_recoverBus(void)
+{
+    uint8 clocks;
+
+    /* Take both pins from the TWI module */
+    TWCR = 0;
+    TWI_releaseLine(TWI_SCL_PORT_ID, TWI_SCL_PIN_ID);
+    TWI_releaseLine(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID);
+    if(!TWI_waitSclHigh())
+    {
+        return FALSE;
+    }
+
+    /* Each clock lets the slave shift out one more bit, SDA is free at the latest after its ACK slot */
+    for(clocks = 0; (clocks < TWI_RECOVERY_CLOCKS) &&
+        (GPIO_readPin(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID) == LOGIC_LOW); clocks++)
+    {
+        TWI_driveLineLow(TWI_SCL_PORT_ID, TWI_SCL_PIN_ID);
+        _delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+        TWI_releaseLine(TWI_SCL_PORT_ID, TWI_SCL_PIN_ID);
+        if(!TWI_waitSclHigh())
+        {
+            return FALSE;
+        }
+        _delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+    }
+
+    if(GPIO_readPin(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID) == LOGIC_LOW)
+    {
+        return FALSE;
+    }
+
+    /* START then STOP while SCL is high resets the state machine of every slave */
+    TWI_driveLineLow(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID);
+    _delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+    TWI_releaseLine(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID);
+    _delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+
+    return (GPIO_readPin(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID) == LOGIC_HIGH) &&
+           (GPIO_readPin(TWI_SCL_PORT_ID, TWI_SCL_PIN_ID) == LOGIC_HIGH);
+}
+
+/*
+ * Description :
+ * Ends a failed blocking transfer with a STOP. If the STOP does not get out
+ * or a slave still holds SDA, the bus is clocked free and the module enabled
+ * again. Returns error for the caller to pass on.
+ */
+static TWI_ErrorType TWI_abort(TWI_ErrorType error)
+{
+    TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+    if(!TWI_waitStop() || (GPIO_readPin(TWI_SDA_PORT_ID, TWI_SDA_PIN_ID) == LOGIC_LOW))
+    {
+        TWI_recoverBus();
+        TWCR = (1 << TWEN);
+    }
+
+    return error;
+}
+
+/*
+ * Description :
+ * Sends the slave address byte after a (repeated) START and checks the
+ * ACK for its R/W direction.
+ */
+static TWI_ErrorType TWI_sendAddress(uint8 slave_address)
 {
-    /* Bit Rate: 400.000 kbps using zero pre-scaler TWPS=00 and F_CPU=8Mhz */
-	TWBR = (uint8_t) ( ( (F_CPU / Config_Ptr->bit_rate) - 16 ) / 2 );
-	TWSR = 0x00;
+    TWDR = slave_address;
+    TWCR = (1 << TWINT) | (1 << TWEN);
+    if(!TWI_waitInterrupt())
+    {
+        return TWI_abort(TWI_ERROR_ADDRESS_TIMEOUT);
+    }
+    if(TWI_getStatus() != ((slave_address & 1) ? TWI_MT_SLA_R_ACK : TWI_MT_SLA_W_ACK))
+    {
+        return TWI_abort(TWI_ERROR_ADDRESS);
+    }
+
+    return TWI_OK;
+}
+
+boolean TWI_init(const TWI_ConfigType * Config_Ptr)
+{
+    boolean bus_free;
+    uint32 cycles, twbr = 0;
+    uint8 twps;
+
+    bus_free = TWI_recoverBus();
+
+    /*
+     * SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS). Use the smallest prescaler
+     * that fits TWBR in 8 bits for the finest steps, and round TWBR up so
+     * the bus never runs faster than requested.
+     */
+    cycles = (Config_Ptr->bit_rate > 0) ?
+             ((F_CPU + Config_Ptr->bit_rate - 1) / Config_Ptr->bit_rate) : 0xFFFFFFFF;
+    for(twps = 0; twps < 4; twps++)
+    {
+        twbr = (cycles > 16) ? ((cycles - 16 + (2UL << (2 * twps)) - 1) / (2UL << (2 * twps))) : 0;
+        if(twbr <= 0xFF)
+        {
+            break;
+        }
+    }
+    if(twps > 3)
+    {
+        /* Slower than the largest prescaler can go */
+        twps = 3;
+        twbr = 0xFF;
+    }
+    if(twbr < TWI_TWBR_MIN)
+    {
+        twbr = TWI_TWBR_MIN;
+    }
+
+	TWBR = (uint8)twbr;
+	TWSR = twps;
+    g_bitRate = F_CPU / (16 + (twbr << (2 * twps + 1)));
 
     /* Two Wire Bus address my address if any master device want to call me: 0x1 (used in case this MC is a slave device)
        General Call Recognition: Off */
 	TWAR = (Config_Ptr->address << 1); // my address = 0x01 :)
 
     TWCR = (1<<TWEN); /* enable TWI */
+
+    return bus_free;
+}
+
+TWI_BaudRateType TWI_getBitRate(void)
+{
+    return g_bitRate;
 }
 
 void TWI_start(void)
 {
+    /* Let the interrupt driven engine finish its queue first, the status shows a failure */
+    if(!TWI_waitEngineIdle())
+    {
+        return;
+    }
+
     /*
 	 * Clear the TWINT flag before sending the start bit TWINT=1
 	 * send the start bit by TWSTA=1
@@ -33,7 +472,7 @@ void TWI_start(void)
     TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
 
     /* Wait for TWINT flag set in TWCR Register (start bit is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_waitInterrupt();
 }
 
 void TWI_stop(void)
@@ -44,6 +483,9 @@ void TWI_stop(void)
 	 * Enable TWI Module TWEN=1
 	 */
     TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+
+    /* TWSTO is cleared once the stop bit is on the bus, a START must not overlap it */
+    TWI_waitStop();
 }
 
 void TWI_writeByte(uint8 data)
@@ -56,7 +498,7 @@ void TWI_writeByte(uint8 data)
 	 */
     TWCR = (1 << TWINT) | (1 << TWEN);
     /* Wait for TWINT flag set in TWCR Register(data is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_waitInterrupt();
 }
 
 uint8 TWI_readByteWithACK(void)
@@ -68,7 +510,7 @@ uint8 TWI_readByteWithACK(void)
 	 */
     TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
     /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_waitInterrupt();
     /* Read Data */
     return TWDR;
 }
@@ -81,7 +523,7 @@ uint8 TWI_readByteWithNACK(void)
 	 */
     TWCR = (1 << TWINT) | (1 << TWEN);
     /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+    TWI_waitInterrupt();
     /* Read Data */
     return TWDR;
 }
@@ -93,3 +535,182 @@ uint8 TWI_getStatus(void)
     status = TWSR & 0xF8;
     return status;
 }
+
+TWI_ErrorType TWI_startTransfer(uint8 slave_address)
+{
+    if(!TWI_waitEngineIdle())
+    {
+        return TWI_ERROR_BUSY;
+    }
+    if(!TWI_waitStop())
+    {
+        return TWI_abort(TWI_ERROR_BUSY);
+    }
+
+    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+    if(!TWI_waitInterrupt())
+    {
+        return TWI_abort(TWI_ERROR_START_TIMEOUT);
+    }
+    if(TWI_getStatus() != TWI_START)
+    {
+        return TWI_abort(TWI_ERROR_START);
+    }
+
+    return TWI_sendAddress(slave_address);
+}
+
+TWI_ErrorType TWI_restartTransfer(uint8 slave_address)
+{
+    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+    if(!TWI_waitInterrupt())
+    {
+        return TWI_abort(TWI_ERROR_RESTART_TIMEOUT);
+    }
+    if(TWI_getStatus() != TWI_REP_START)
+    {
+        return TWI_abort(TWI_ERROR_RESTART);
+    }
+
+    return TWI_sendAddress(slave_address);
+}
+
+TWI_ErrorType TWI_writeData(uint8 data)
+{
+    TWDR = data;
+    TWCR = (1 << TWINT) | (1 << TWEN);
+    if(!TWI_waitInterrupt())
+    {
+        return TWI_abort(TWI_ERROR_DATA_TIMEOUT);
+    }
+    if(TWI_getStatus() != TWI_MT_DATA_ACK)
+    {
+        return TWI_abort(TWI_ERROR_DATA);
+    }
+
+    return TWI_OK;
+}
+
+TWI_ErrorType TWI_readData(uint8 *data, boolean ack)
+{
+    TWCR = ack ? ((1 << TWINT) | (1 << TWEN) | (1 << TWEA)) : ((1 << TWINT) | (1 << TWEN));
+    if(!TWI_waitInterrupt())
+    {
+        return TWI_abort(TWI_ERROR_READ_TIMEOUT);
+    }
+    if(TWI_getStatus() != (ack ? TWI_MR_DATA_ACK : TWI_MR_DATA_NACK))
+    {
+        return TWI_abort(TWI_ERROR_READ);
+    }
+    *data = TWDR;
+
+    return TWI_OK;
+}
+
+TWI_ErrorType TWI_stopTransfer(void)
+{
+    TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+    if(!TWI_waitStop())
+    {
+        TWI_recoverBus();
+        TWCR = (1 << TWEN);
+        return TWI_ERROR_STOP_TIMEOUT;
+    }
+
+    return TWI_OK;
+}
+
+boolean TWI_submit(TWI_TransactionType *transaction)
+{
+    uint8 sreg;
+
+    if(TWI_isPending(transaction) ||
+       ((TWI_READ == transaction->direction) && (0 == transaction->length)))
+    {
+        return FALSE;
+    }
+
+    /* Do not queue behind a transaction that is stuck on the bus */
+    TWI_checkDeadline();
+
+    transaction->status = TWI_TRANSACTION_QUEUED;
+    transaction->error_status = 0;
+    transaction->next = NULL_PTR;
+
+    sreg = SREG;
+    CLEAR_BIT(SREG, 7);
+    if(NULL_PTR == g_tail)
+    {
+        g_head = transaction;
+    }
+    else
+    {
+        g_tail->next = transaction;
+    }
+    g_tail = transaction;
+
+    if(!g_engineActive)
+    {
+        g_engineActive = TRUE;
+        transaction->status = TWI_TRANSACTION_BUSY;
+        g_headStartMs = Systick_getMs();
+        g_phase = TWI_PHASE_WRITE;
+        g_headerIndex = 0;
+        g_dataIndex = 0;
+        g_pollsLeft = TWI_READY_POLL_LIMIT;
+
+        /* A STOP of the blocking functions may still be on the bus */
+        TWI_waitStop();
+        TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+    }
+    SREG = sreg;
+
+    return TRUE;
+}
+
+boolean TWI_isPending(const TWI_TransactionType *transaction)
+{
+    TWI_checkDeadline();
+
+    return (TWI_TRANSACTION_QUEUED == transaction->status) || (TWI_TRANSACTION_BUSY == transaction->status);
+}
+
+boolean TWI_isBusy(void)
+{
+    TWI_checkDeadline();
+
+    return g_engineActive;
+}
+
+void TWI_cancel(void)
+{
+    TWI_TransactionType *transaction;
+    TWI_TransactionType *next;
+    uint8 sreg = SREG;
+
+    /* Detach the queue and stop the engine, no TWI interrupt follows */
+    CLEAR_BIT(SREG, 7);
+    transaction = g_head;
+    g_head = NULL_PTR;
+    g_tail = NULL_PTR;
+    g_engineActive = FALSE;
+    TWCR = 0;
+    SREG = sreg;
+
+    /* A slave may be left in the middle of a byte, free the bus before anything new starts */
+    TWI_recoverBus();
+    TWCR = (1 << TWEN);
+
+    /* The call backs may already submit again */
+    while(transaction != NULL_PTR)
+    {
+        next = transaction->next;
+        transaction->error_status = TWI_NO_STATE;
+        transaction->status = TWI_TRANSACTION_ERROR;
+        if(transaction->callback != NULL_PTR)
+        {
+            transaction->callback(transaction);
+        }
+        transaction = next;
+    }
+}
@@ -20,11 +20,59 @@
 #define TWI_MT_SLA_W_ACK  0x18 /* Master transmit ( slave address + Write request ) to slave + ACK received from slave. */
 #define TWI_MT_SLA_R_ACK  0x40 /* Master transmit ( slave address + Read request ) to slave + ACK received from slave. */
 #define TWI_MT_DATA_ACK   0x28 /* Master transmit data and ACK has been received from Slave. */
+#define TWI_MT_DATA_NACK  0x30 /* Master transmit data and NACK has been received from Slave. */
 #define TWI_MR_DATA_ACK   0x50 /* Master received data and send ACK to slave. */
 #define TWI_MR_DATA_NACK  0x58 /* Master received data but doesn't send ACK to slave. */
+#define TWI_MT_SLA_W_NACK 0x20 /* Master transmit ( slave address + Write request ) to slave + NACK received from slave. */
+#define TWI_NO_STATE      0xF8 /* No bus event, error_status of a cancelled transaction */
+
+/* Transaction direction: header bytes are always written first */
+#define TWI_WRITE         0
+#define TWI_READ          1
+
+/* Transaction flags */
+#define TWI_FLAG_WAIT_READY  0x01 /* After a write, poll the slave until it ACKs its address again (EEPROM write cycle) */
+
+/* Most address polls of a TWI_FLAG_WAIT_READY transaction, about 14 ms at 222 kHz */
+#define TWI_READY_POLL_LIMIT 255
+
+/* Bus speed profiles, TWI_init never runs the bus faster than requested */
+#define TWI_BIT_RATE_STANDARD   100000UL    /* Standard mode */
+#define TWI_BIT_RATE_FAST       400000UL    /* Fast mode, 222 kHz at F_CPU = 8 MHz (see TWI_TWBR_MIN) */
+
+/*
+ * Smallest TWBR allowed in master mode, with a lower value the master may
+ * produce a wrong SDA/SCL output (data sheet note). This caps SCL at
+ * F_CPU / 36.
+ */
+#define TWI_TWBR_MIN            10
+
+/* SCL and SDA pins, driven by software during a bus recovery */
+#define TWI_SCL_PORT_ID         PORTC_ID
+#define TWI_SCL_PIN_ID          PIN0_ID
+#define TWI_SDA_PORT_ID         PORTC_ID
+#define TWI_SDA_PIN_ID          PIN1_ID
+
+/* Bus recovery: clock pulses to free SDA, SCL half period and clock stretching limit */
+#define TWI_RECOVERY_CLOCKS         9
+#define TWI_RECOVERY_HALF_PERIOD_US 5       /* 100 kHz */
+#define TWI_RECOVERY_STRETCH_US     1000
+
+/* Longest wait of the blocking functions for one bus event, a byte takes 90 us at 100 kHz */
+#define TWI_WAIT_TIMEOUT_US         1000
+
+/* Longest wait of the blocking functions for the interrupt driven engine to go idle */
+#define TWI_ENGINE_TIMEOUT_US       50000
+
+/*
+ * Longest time one queued transaction may stay on the bus, above the ready
+ * polling of a page write at TWI_BIT_RATE_STANDARD (about 32 ms). A
+ * transaction whose next bus event never comes cancels the queue after it.
+ */
+#define TWI_TRANSACTION_TIMEOUT_MS  50
 
 typedef unsigned char TWI_AddressType;
-typedef unsigned int TWI_BaudRateType;
+typedef uint32 TWI_BaudRateType;
 
 
 typedef struct {
@@ -32,11 +80,96 @@ TWI_AddressType address;
 TWI_BaudRateType bit_rate;
 }TWI_ConfigType;
 
+/*
+ * Result of the guarded blocking functions: the stage that failed and
+ * whether the slave answered wrong or the bus never answered at all.
+ * The bus is already released when a function returns an error.
+ */
+typedef enum {
+    TWI_OK,
+    TWI_ERROR_BUSY,             /* The engine or the previous STOP did not finish in time */
+    TWI_ERROR_START,            /* START not sent (bus error, arbitration lost) */
+    TWI_ERROR_START_TIMEOUT,
+    TWI_ERROR_RESTART,          /* Repeated START not sent */
+    TWI_ERROR_RESTART_TIMEOUT,
+    TWI_ERROR_ADDRESS,          /* No slave acknowledged SLA+W/SLA+R */
+    TWI_ERROR_ADDRESS_TIMEOUT,
+    TWI_ERROR_DATA,             /* The slave did not acknowledge a data byte */
+    TWI_ERROR_DATA_TIMEOUT,
+    TWI_ERROR_READ,             /* Unexpected status after receiving a byte */
+    TWI_ERROR_READ_TIMEOUT,
+    TWI_ERROR_STOP_TIMEOUT      /* STOP never got on the bus, the bus was recovered */
+} TWI_ErrorType;
+
+/* State of a queued transaction */
+typedef enum {
+    TWI_TRANSACTION_IDLE,       /* Never submitted */
+    TWI_TRANSACTION_QUEUED,     /* Waiting for the bus */
+    TWI_TRANSACTION_BUSY,       /* On the bus */
+    TWI_TRANSACTION_DONE,       /* Finished successfully */
+    TWI_TRANSACTION_ERROR       /* Finished with an unexpected bus status, see error_status */
+} TWI_TransactionStatusType;
+
+/*
+ * Transaction descriptor for the interrupt driven engine. The caller owns the
+ * descriptor and the data buffer, both belong to the driver from TWI_submit
+ * until the status is DONE or ERROR.
+ *
+ *   write: START, SLA+W, header, data, STOP
+ *   read:  START, SLA+W, header, REPEATED START, SLA+R, data, STOP
+ *          (without header: START, SLA+R, data, STOP)
+ */
+typedef struct TWI_Transaction {
+    uint8 slave_address;                    /* Slave address byte with R/W = 0 (e.g. 0xA0) */
+    uint8 direction;                        /* TWI_WRITE or TWI_READ */
+    uint8 flags;                            /* TWI_FLAG_x */
+    uint8 header[2];                        /* Bytes written first, e.g. the memory address */
+    uint8 header_length;                    /* 0 to 2 */
+    uint8 *data;                            /* Data to write or buffer for the read bytes */
+    uint8 length;                           /* Number of data bytes, at least 1 for a read */
+    void (*callback)(struct TWI_Transaction *transaction); /* Called from the ISR when finished, may be NULL_PTR */
+    volatile TWI_TransactionStatusType status;
+    volatile uint8 error_status;            /* TWSR status that ended a failed transaction */
+    struct TWI_Transaction *next;           /* Queue link, used by the driver */
+} TWI_TransactionType;
+
 
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
-void TWI_init(const TWI_ConfigType * Config_Ptr);
+
+/*
+ * Description :
+ * Frees the bus and sets up the bit rate. The prescaler and TWBR are
+ * chosen together for the closest rate not above bit_rate, limited to the
+ * range TWBR >= TWI_TWBR_MIN and the largest prescaler can reach, see
+ * TWI_getBitRate for the rate actually used.
+ * Returns FALSE if a slave still holds the bus after the recovery.
+ */
+boolean TWI_init(const TWI_ConfigType * Config_Ptr);
+
+/*
+ * Description :
+ * Returns the SCL frequency in Hz set up by TWI_init.
+ */
+TWI_BaudRateType TWI_getBitRate(void);
+
+/*
+ * Description :
+ * Bus clear: a slave reset in the middle of a byte may hold SDA low and
+ * block every START. Disables the TWI module, clocks SCL by software up to
+ * TWI_RECOVERY_CLOCKS times until SDA is released and ends with a STOP.
+ * Every wait for SCL (clock stretching) is bounded by TWI_RECOVERY_STRETCH_US.
+ * Returns TRUE if both lines are high, the TWI module must be set up again
+ * with TWI_init.
+ */
+boolean TWI_recoverBus(void);
+
+/*
+ * Raw blocking functions, the caller checks TWI_getStatus after each one.
+ * Every wait is bounded by TWI_WAIT_TIMEOUT_US (TWI_ENGINE_TIMEOUT_US for
+ * the engine), after a timeout the status does not match the expected one.
+ */
 void TWI_start(void);
 void TWI_stop(void);
 void TWI_writeByte(uint8 data);
@@ -44,5 +177,73 @@ uint8 TWI_readByteWithACK(void);
 uint8 TWI_readByteWithNACK(void);
 uint8 TWI_getStatus(void);
 
+/*
+ * Description :
+ * Guarded blocking transfer: START followed by the slave address byte,
+ * R/W is bit 0 of slave_address. Waits at most TWI_ENGINE_TIMEOUT_US for
+ * the interrupt driven engine and TWI_WAIT_TIMEOUT_US for every bus event.
+ * On an error the bus is released with a STOP (or a bus recovery if the
+ * STOP does not get out) before returning.
+ */
+TWI_ErrorType TWI_startTransfer(uint8 slave_address);
+
+/*
+ * Description :
+ * Repeated START followed by the slave address byte, to turn a write of the
+ * register address into a read. Releases the bus on an error.
+ */
+TWI_ErrorType TWI_restartTransfer(uint8 slave_address);
+
+/*
+ * Description :
+ * Sends one data byte, the slave must acknowledge it. Releases the bus on an error.
+ */
+TWI_ErrorType TWI_writeData(uint8 data);
+
+/*
+ * Description :
+ * Receives one data byte and acknowledges it if ack is TRUE (more bytes
+ * follow) or not (last byte). Releases the bus on an error.
+ */
+TWI_ErrorType TWI_readData(uint8 *data, boolean ack);
+
+/*
+ * Description :
+ * Ends the transfer with a STOP, recovers the bus if it does not get out.
+ */
+TWI_ErrorType TWI_stopTransfer(void);
+
+/*
+ * Description :
+ * Queues a transaction for the TWI_vect driven engine and returns at once.
+ * The bus is started right away if it is idle. Returns FALSE if the
+ * descriptor is still queued or on the bus.
+ * The blocking functions above wait until the engine is idle before they
+ * touch the bus.
+ */
+boolean TWI_submit(TWI_TransactionType *transaction);
+
+/*
+ * Description :
+ * Returns TRUE while the descriptor is queued or on the bus.
+ */
+boolean TWI_isPending(const TWI_TransactionType *transaction);
+
+/*
+ * Description :
+ * Returns TRUE while the engine has queued transactions.
+ */
+boolean TWI_isBusy(void);
+
+/*
+ * Description :
+ * Stops the interrupt driven engine, recovers the bus and ends every queued
+ * transaction with TWI_TRANSACTION_ERROR and error_status TWI_NO_STATE,
+ * calling their call backs. Done by the driver itself once the transaction
+ * on the bus passed TWI_TRANSACTION_TIMEOUT_MS, seen by TWI_submit,
+ * TWI_isPending, TWI_isBusy and the blocking functions.
+ */
+void TWI_cancel(void);
+
 
 #endif /* TWI_H_ */
@@ -7,8 +7,177 @@
 
 #include "uart.h"
 #include "avr/io.h" /* To use the UART Registers */
+#include <avr/interrupt.h> /* For UART ISRs */
 #include <util/delay.h>
 #include "common_macros.h" /* To use the macros like SET_BIT */
+#include "systick.h" /* For the timeout deadlines */
+
+/*******************************************************************************
+ *                       Compile Time Checks                                   *
+ *******************************************************************************/
+
+#if (UART_BAUD_ERROR_PERMILLE(UART_LINK_BAUD_RATE) > UART_MAX_BAUD_ERROR_PERMILLE)
+#error "UART_LINK_BAUD_RATE can not be generated from F_CPU within UART_MAX_BAUD_ERROR_PERMILLE"
+#endif
+
+#if (UART_UBRR_NORMAL(UART_LINK_BAUD_RATE) > 4095UL)
+#error "UART_LINK_BAUD_RATE is out of the UBRR range for F_CPU"
+#endif
+
+#if ((UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) != 0) || (UART_RX_BUFFER_SIZE > 128)
+#error "UART_RX_BUFFER_SIZE must be a power of two not larger than 128"
+#endif
+
+#if ((UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) != 0) || (UART_TX_BUFFER_SIZE > 128)
+#error "UART_TX_BUFFER_SIZE must be a power of two not larger than 128"
+#endif
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/*
+ * RX ring buffer: the RXC ISR writes at g_rxHead, the application reads at g_rxTail.
+ * TX ring buffer: the application writes at g_txHead, the UDRE ISR reads at g_txTail.
+ * One slot is always left empty to tell a full buffer from an empty one.
+ */
+static volatile uint8 g_rxBuffer[UART_RX_BUFFER_SIZE];
+static volatile uint8 g_rxHead = 0;
+static volatile uint8 g_rxTail = 0;
+
+static volatile uint8 g_txBuffer[UART_TX_BUFFER_SIZE];
+static volatile uint8 g_txHead = 0;
+static volatile uint8 g_txTail = 0;
+
+/*
+ * Zero-copy transmit: the UDRE ISR reads straight from the caller's buffer
+ * once the TX ring buffer is empty, then calls the completion call back.
+ */
+static const uint8 * volatile g_asyncBuffer = NULL_PTR;
+static volatile uint8 g_asyncLength = 0;
+static volatile uint8 g_asyncIndex = 0;
+static void (* volatile g_asyncCallBack)(void) = NULL_PTR;
+
+/* Link statistics, updated from the ISRs and the protocol layers */
+static volatile UART_StatsType g_stats;
+
+/*
+ * Idle line delimiter: when enabled, a line idle for g_idleDelimiterMs ends
+ * the current frame, the RXC ISR stores a 0x00 delimiter before the next byte.
+ */
+static volatile uint16 g_idleDelimiterMs = 0;
+static volatile uint32 g_lastRxTime = 0;
+
+/* Own address on a multi-drop bus, UART_NO_ADDRESS when not used */
+static uint8 g_nodeAddress = UART_NO_ADDRESS;
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+/* Receive complete: move the byte from UDR into the RX ring buffer */
+ISR(USART_RXC_vect)
+{
+    /* The error flags and the 9th bit belong to the byte in UDR, read them before UDR */
+    uint8 status = UCSRA;
+    uint8 ninth_bit = BIT_IS_SET(UCSRB, RXB8);
+    uint8 data = UDR;
+    uint8 next = (g_rxHead + 1) & (UART_RX_BUFFER_SIZE - 1);
+    uint32 now;
+
+    g_stats.bytes_in++;
+    if(BIT_IS_SET(status, DOR))
+    {
+        g_stats.overruns++;
+    }
+    if(BIT_IS_SET(status, FE))
+    {
+        g_stats.framing_errors++;
+    }
+    if(BIT_IS_SET(status, PE))
+    {
+        g_stats.parity_errors++;
+    }
+
+    /*
+     * Address byte on a multi-drop bus: wake up for our own address and
+     * let the hardware filter the data bytes again for any other one.
+     */
+    if((g_nodeAddress != UART_NO_ADDRESS) && ninth_bit)
+    {
+        if(data == g_nodeAddress)
+        {
+            CLEAR_BIT(UCSRA, MPCM);
+        }
+        else
+        {
+            SET_BIT(UCSRA, MPCM);
+        }
+        return;
+    }
+
+    if(g_idleDelimiterMs != 0)
+    {
+        now = Systick_getMs();
+        if(((now - g_lastRxTime) >= g_idleDelimiterMs) && (next != g_rxTail))
+        {
+            g_rxBuffer[g_rxHead] = UART_IDLE_DELIMITER;
+            g_rxHead = next;
+            next = (g_rxHead + 1) & (UART_RX_BUFFER_SIZE - 1);
+        }
+        g_lastRxTime = now;
+    }
+
+    /* Drop the byte if the buffer is full, the application is too slow */
+    if(next != g_rxTail)
+    {
+        g_rxBuffer[g_rxHead] = data;
+        g_rxHead = next;
+    }
+    else
+    {
+        g_stats.rx_buffer_drops++;
+    }
+}
+
+/*
+ * Data register empty: feed the next byte queued in the ring buffer, then the
+ * next byte of the asynchronous buffer, or stop the interrupt.
+ */
+ISR(USART_UDRE_vect)
+{
+    void (*done)(void);
+
+    if(g_txHead != g_txTail)
+    {
+        UDR = g_txBuffer[g_txTail];
+        g_txTail = (g_txTail + 1) & (UART_TX_BUFFER_SIZE - 1);
+        g_stats.bytes_out++;
+    }
+    else if(g_asyncBuffer != NULL_PTR)
+    {
+        UDR = g_asyncBuffer[g_asyncIndex];
+        g_asyncIndex++;
+        g_stats.bytes_out++;
+
+        if(g_asyncIndex == g_asyncLength)
+        {
+            /* Release the buffer before the call back so it can start the next transfer */
+            done = g_asyncCallBack;
+            g_asyncBuffer = NULL_PTR;
+            g_asyncCallBack = NULL_PTR;
+            if(done != NULL_PTR)
+            {
+                (*done)();
+            }
+        }
+    }
+    else
+    {
+        /* Nothing left to send, disable the interrupt until new data is queued */
+        CLEAR_BIT(UCSRB, UDRIE);
+    }
+}
 
 /*******************************************************************************
  *                      Functions Definitions                                  *
@@ -20,150 +189,412 @@
  * Functional responsible for Initialize the UART device by:
  * 1. Setup the Frame format like number of data bits, parity bit type and number of stop bits.
  * 2. Enable the UART.
- * 3. Setup the UART baud rate.
+ * 3. Setup the UART baud rate, selecting normal or double speed mode.
  */
 void UART_init(const UART_ConfigType * Config_Ptr)
 {
-    uint16 ubrr_value = 0;
+    UART_BaudSettingType baud_setting;
+    uint8 ucsra_value;
+    uint8 ucsrc_value;
+
+    /* Start with empty ring buffers */
+    g_rxHead = 0;
+    g_rxTail = 0;
+    g_txHead = 0;
+    g_txTail = 0;
+    g_asyncBuffer = NULL_PTR;
+    g_asyncCallBack = NULL_PTR;
+    g_nodeAddress = Config_Ptr->node_address;
+    UART_clearStats();
+
+    /************************** UCSRC Description **************************
+     * URSEL   = 1 The URSEL must be one when writing the UCSRC to select UCSRC register
+     * UMSEL   = 0 Asynchronous Operation
+     * UPM1:0  = parity mode from the configuration
+     * USBS    = stop bits from the configuration
+     * UCSZ1:0 = lower two bits of the data bits size
+     * UCPOL   = 0 Used only in synchronous mode
+     *
+     * UCSRC shares its I/O address with UBRRH, so it is written once with
+     * URSEL set instead of being modified bit by bit.
+     ***********************************************************************/
+    ucsrc_value = (1<<URSEL);
+    ucsrc_value |= ((Config_Ptr->parity & 0x03) << UPM0);
+    ucsrc_value |= ((Config_Ptr->stop_bit & 0x01) << USBS);
+    ucsrc_value |= ((Config_Ptr->bit_data & 0x03) << UCSZ0);
+
+    /************************** UCSRB Description **************************
+     * RXCIE = 1 Enable USART RX Complete Interrupt Enable
+     * TXCIE = 0 Disable USART Tx Complete Interrupt Enable
+     * UDRIE = 0 Disabled until data is queued in the TX ring buffer
+     * RXEN  = 1 Receiver Enable
+     * TXEN  = 1 Transmitter Enable
+     * UCSZ2 = 1 Only for 9-bit data mode
+     ***********************************************************************/
+    UCSRB = (1<<RXCIE) | (1<<RXEN) | (1<<TXEN) | (((Config_Ptr->bit_data >> 2) & 0x01) << UCSZ2);
+    UCSRC = ucsrc_value;
+
+    /*
+     * Pick normal or double speed mode, whichever is more accurate.
+     * An unreachable baud rate still gets the closest setting.
+     * A node on a multi-drop bus starts filtered until it is addressed.
+     */
+    UART_calculateBaudRate(Config_Ptr->baud_rate, &baud_setting);
+    ucsra_value = 0;
+    if(baud_setting.double_speed)
+    {
+        ucsra_value |= (1<<U2X);
+    }
+    if(g_nodeAddress != UART_NO_ADDRESS)
+    {
+        ucsra_value |= (1<<MPCM);
+    }
+    UCSRA = ucsra_value;
+
+    /* Assign baud rate values to registers (URSEL = 0 selects UBRRH) */
+    UBRRH = (uint8)((baud_setting.ubrr >> 8) & 0x0F);
+    UBRRL = (uint8)baud_setting.ubrr;
+}
+
+/*
+ * Description :
+ * Function responsible for calculating the UBRR value of the requested
+ * baud rate in normal (F_CPU/16) and double speed (F_CPU/8) mode and
+ * keeping the more accurate one. Normal mode wins on a tie because the
+ * receiver takes more samples per bit.
+ */
+boolean UART_calculateBaudRate(UART_BaudRateType baud_rate, UART_BaudSettingType *setting)
+{
+    uint32 ubrr_normal, ubrr_double;
+    uint32 actual_normal, actual_double;
+    uint32 error_normal, error_double;
 
-    /* Configure frame format: stop bits */
-    UCSRC = ((1<<USBS) | Config_Ptr->stop_bit);
+    /* Round UBRR to the nearest value in both modes */
+    ubrr_normal = (F_CPU + 8UL * baud_rate) / (16UL * baud_rate);
+    ubrr_double = (F_CPU + 4UL * baud_rate) / (8UL * baud_rate);
 
-    /* Configure parity mode bits */
-    switch(Config_Ptr->parity)
+    /* UBRR is 12 bits wide and a divider of 0 is not possible */
+    if(ubrr_normal == 0)
     {
-        case PARITY_DISABLED :
-            CLEAR_BIT(UCSRC, UPM0);
-            CLEAR_BIT(UCSRC, UPM1);
-            break;
-        case PARITY_EVEN :
-            CLEAR_BIT(UCSRC, UPM0);
-            SET_BIT(UCSRC, UPM1);
-            break;
-        case PARITY_ODD :
-            SET_BIT(UCSRC, UPM0);
-            SET_BIT(UCSRC, UPM1);
-            break;
+        ubrr_normal = 1;
+    }
+    if(ubrr_double == 0)
+    {
+        ubrr_double = 1;
+    }
+    if(ubrr_normal > 4096)
+    {
+        ubrr_normal = 4096;
+    }
+    if(ubrr_double > 4096)
+    {
+        ubrr_double = 4096;
     }
 
-    /* Configure data bits size */
-    switch(Config_Ptr->bit_data)
+    actual_normal = F_CPU / (16UL * ubrr_normal);
+    actual_double = F_CPU / (8UL * ubrr_double);
+
+    error_normal = UART_ERROR_PERMILLE(actual_normal, baud_rate);
+    error_double = UART_ERROR_PERMILLE(actual_double, baud_rate);
+
+    if(error_double < error_normal)
     {
-        case BIT_DATA_5 :
-            CLEAR_BIT(UCSRC, UCSZ0);
-            CLEAR_BIT(UCSRC, UCSZ1);
-            CLEAR_BIT(UCSRB, UCSZ2);
-            break;
-        case BIT_DATA_6 :
-            SET_BIT(UCSRC, UCSZ0);
-            CLEAR_BIT(UCSRC, UCSZ1);
-            CLEAR_BIT(UCSRB, UCSZ2);
-            break;
-        case BIT_DATA_7 :
-            CLEAR_BIT(UCSRC, UCSZ0);
-            SET_BIT(UCSRC, UCSZ1);
-            CLEAR_BIT(UCSRB, UCSZ2);
-            break;
-        case BIT_DATA_8 :
-            SET_BIT(UCSRC, UCSZ0);
-            SET_BIT(UCSRC, UCSZ1);
-            CLEAR_BIT(UCSRB, UCSZ2);
-            break;
-        case BIT_DATA_9 :
-            SET_BIT(UCSRC, UCSZ0);
-            SET_BIT(UCSRC, UCSZ1);
-            SET_BIT(UCSRB, UCSZ2);
+        setting->ubrr = (uint16)(ubrr_double - 1);
+        setting->double_speed = TRUE;
+        setting->error_permille = (uint16)error_double;
+    }
+    else
+    {
+        setting->ubrr = (uint16)(ubrr_normal - 1);
+        setting->double_speed = FALSE;
+        setting->error_permille = (uint16)error_normal;
+    }
+
+    return (setting->error_permille <= UART_MAX_BAUD_ERROR_PERMILLE) ? TRUE : FALSE;
+}
+
+/*
+ * Description :
+ * Function responsible for queuing up to len bytes in the TX ring buffer.
+ * Returns the number of bytes queued, never waits.
+ */
+uint8 UART_write(const uint8 *data, uint8 len)
+{
+    uint8 count = 0;
+    uint8 next;
+
+    /* Keep the byte order, nothing may be queued behind an asynchronous buffer */
+    if(g_asyncBuffer != NULL_PTR)
+    {
+        return 0;
+    }
+
+    while(count < len)
+    {
+        next = (g_txHead + 1) & (UART_TX_BUFFER_SIZE - 1);
+
+        /* Stop when the buffer is full */
+        if(next == g_txTail)
+        {
             break;
+        }
+
+        g_txBuffer[g_txHead] = data[count];
+        g_txHead = next;
+        count++;
     }
 
-    /* Enable double transmission speed */
-    UCSRA = (1<<U2X);
+    if(count > 0)
+    {
+        /* Let the UDRE interrupt drain the buffer */
+        SET_BIT(UCSRB, UDRIE);
+    }
 
-    /************************** UCSRB Description **************************
-     * RXCIE = 0 Disable USART RX Complete Interrupt Enable
-     * TXCIE = 0 Disable USART Tx Complete Interrupt Enable
-     * UDRIE = 0 Disable USART Data Register Empty Interrupt Enable
-     * RXEN  = 1 Receiver Enable
-     * TXEN  = 1 Transmitter Enable
-     * UCSZ2 = 0 For 8-bit data mode (can be set for others)
-     ***********************************************************************/
-    UCSRB = (1<<RXEN) | (1<<TXEN);
+    return count;
+}
 
-    /************************** UCSRC Description **************************
-     * URSEL   = 1 The URSEL must be one when writing the UCSRC to select UCSRC register
-     * UMSEL   = 0 Asynchronous Operation
-     * UPM1:0  = 00 Disable parity bit (set above as needed)
-     * USBS    = 0 One stop bit (set above as needed)
-     * UCSZ1:0 = 11 For 8-bit data mode (set above as needed)
-     * UCPOL   = 0 Used only in synchronous mode
-     ***********************************************************************/
-    UCSRC |= (1<<URSEL);
+/*
+ * Description :
+ * Function responsible for starting a zero-copy transmit of len bytes from buf.
+ */
+boolean UART_sendBufferAsync(const uint8 *buf, uint8 len, void (*done)(void))
+{
+    if(g_asyncBuffer != NULL_PTR)
+    {
+        return FALSE;
+    }
+
+    if(len == 0)
+    {
+        if(done != NULL_PTR)
+        {
+            (*done)();
+        }
+        return TRUE;
+    }
+
+    g_asyncLength = len;
+    g_asyncIndex = 0;
+    g_asyncCallBack = done;
+    /* Setting the buffer last arms the transfer for the ISR */
+    g_asyncBuffer = buf;
+
+    SET_BIT(UCSRB, UDRIE);
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Function responsible for reporting whether an asynchronous transmit is in progress.
+ */
+boolean UART_isAsyncBusy(void)
+{
+    return (g_asyncBuffer != NULL_PTR) ? TRUE : FALSE;
+}
+
+/*
+ * Description :
+ * Function responsible for copying up to len received bytes out of the
+ * RX ring buffer. Returns the number of bytes copied, never waits.
+ */
+uint8 UART_tryReceive(uint8 *data, uint8 len)
+{
+    uint8 count = 0;
+
+    while((count < len) && (g_rxTail != g_rxHead))
+    {
+        data[count] = g_rxBuffer[g_rxTail];
+        g_rxTail = (g_rxTail + 1) & (UART_RX_BUFFER_SIZE - 1);
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Description :
+ * Function responsible for copying the link statistics. The interrupts are
+ * disabled during the copy so the multi-byte counters are consistent.
+ */
+void UART_getStats(UART_StatsType *stats)
+{
+    uint8 sreg = SREG;
 
-    /* Calculate and set baud rate register value (for double speed mode) */
-    ubrr_value = (uint16)(((F_CPU / (Config_Ptr->baud_rate * 8UL))) - 1);
+    CLEAR_BIT(SREG, 7);
+    *stats = *(const UART_StatsType *)&g_stats;
+    SREG = sreg;
+}
+
+/*
+ * Description :
+ * Function responsible for resetting the link statistics.
+ */
+void UART_clearStats(void)
+{
+    uint8 sreg = SREG;
+
+    CLEAR_BIT(SREG, 7);
+    g_stats.bytes_in = 0;
+    g_stats.bytes_out = 0;
+    g_stats.overruns = 0;
+    g_stats.framing_errors = 0;
+    g_stats.parity_errors = 0;
+    g_stats.rx_buffer_drops = 0;
+    g_stats.retransmits = 0;
+    g_stats.max_ack_wait_ticks = 0;
+    SREG = sreg;
+}
+
+/*
+ * Description :
+ * Function responsible for counting a retransmitted frame.
+ */
+void UART_recordRetransmit(void)
+{
+    g_stats.retransmits++;
+}
+
+/*
+ * Description :
+ * Function responsible for keeping the worst-case ACK wait.
+ */
+void UART_recordAckWait(uint16 ticks)
+{
+    if(ticks > g_stats.max_ack_wait_ticks)
+    {
+        g_stats.max_ack_wait_ticks = ticks;
+    }
+}
 
-    /* Assign baud rate values to registers */
-    UBRRH = ubrr_value >> 8;
-    UBRRL = ubrr_value;
+/*
+ * Description :
+ * Function responsible for returning the number of bytes waiting in the RX ring buffer.
+ */
+uint8 UART_available(void)
+{
+    return (g_rxHead - g_rxTail) & (UART_RX_BUFFER_SIZE - 1);
 }
 
 /*
  * Description :
  * Function responsible for sending a byte via UART.
+ * Thin blocking wrapper over UART_write.
  */
 void UART_sendByte(const uint8 data)
 {
-    /*
-     * Put the required data in the UDR register and it also clears the UDRE flag
-     * since the UDR register is not empty now.
-     */
-    UDR = data;
-
-    /*
-     * Wait until UDRE flag is set, indicating the buffer is empty and
-     * new data can be sent.
-     */
-    while(BIT_IS_CLEAR(UCSRA, UDRE)) {}
+    /* Wait only while the TX ring buffer is full */
+    while(UART_write(&data, 1) == 0) {}
 }
 
 /*
  * Description :
  * Function responsible for receiving a byte via UART.
+ * Thin blocking wrapper over UART_tryReceive.
  */
 uint8 UART_recieveByte(void)
 {
-    /* Wait until RXC flag is set, indicating data received */
-    while(BIT_IS_CLEAR(UCSRA, RXC)) {}
+    uint8 data;
 
-    /*
-     * Read the received data from the Rx buffer (UDR),
-     * which clears the RXC flag.
-     */
-    return UDR;
+    /* Wait until the RX ISR has stored a byte in the ring buffer */
+    while(UART_tryReceive(&data, 1) == 0) {}
+
+    return data;
 }
 
 /*
  * Description :
- * Function responsible for sending a null-terminated string via UART.
+ * Function responsible for receiving a byte via UART within a deadline
+ * measured by the system tick, so a lost byte can never hang the caller.
  */
-void UART_sendString(const uint8 *Str)
+boolean UART_receiveTimeout(uint8 *data, uint16 timeout_ms)
 {
-    uint8 i = 0;
+    uint32 start_ms = Systick_getMs();
 
-    /* Send characters one by one until null terminator */
-    while(Str[i] != '\0')
+    do
     {
-        UART_sendByte(Str[i]);
-        i++;
+        if(UART_tryReceive(data, 1))
+        {
+            return TRUE;
+        }
+    } while(!Systick_isElapsed(start_ms, timeout_ms));
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Function responsible for sending a buffer of len bytes via UART.
+ */
+void UART_sendBuffer(const uint8 *data, uint8 len)
+{
+    uint8 sent = 0;
+
+    /* Queue as much as fits each time until everything is queued */
+    while(sent < len)
+    {
+        sent += UART_write(&data[sent], len - sent);
     }
+}
 
-    /************************* Alternative method *************************
+/*
+ * Description :
+ * Function responsible for sending a node address with the 9th bit set.
+ */
+void UART_sendAddress(uint8 address)
+{
+    uint8 sreg;
+
+    /* Let the ISR hand every queued byte to UDR first */
+    while((g_txHead != g_txTail) || (g_asyncBuffer != NULL_PTR)) {}
+
+    /*
+     * TXB8 is copied with UDR into the shift register, so UDR must be empty
+     * and the UDRE ISR must not load a data byte while TXB8 is set.
+     */
+    sreg = SREG;
+    CLEAR_BIT(SREG, 7);
+    while(BIT_IS_CLEAR(UCSRA, UDRE)) {}
+    SET_BIT(UCSRB, TXB8);
+    UDR = address;
+    g_stats.bytes_out++;
+
+    /* Clear the 9th bit again once the address left UDR */
+    while(BIT_IS_CLEAR(UCSRA, UDRE)) {}
+    CLEAR_BIT(UCSRB, TXB8);
+    SREG = sreg;
+}
+
+/*
+ * Description :
+ * Function responsible for sending a null-terminated string via UART.
+ */
+void UART_sendString(const uint8 *Str)
+{
+    /*
+     * Queue characters until the null terminator, waiting only while the
+     * TX ring buffer is full. Walking the pointer also lifts the old
+     * 255 character limit of the uint8 index.
+     */
     while(*Str != '\0')
     {
         UART_sendByte(*Str);
         Str++;
     }
-    **********************************************************************/
+}
+
+/*
+ * Description :
+ * Function responsible for enabling the idle line delimiter, 0 disables it.
+ */
+void UART_setIdleDelimiter(uint16 idle_ms)
+{
+    uint8 sreg = SREG;
+
+    CLEAR_BIT(SREG, 7);
+    g_lastRxTime = Systick_getMs();
+    g_idleDelimiterMs = idle_ms;
+    SREG = sreg;
 }
 
 /*
@@ -200,21 +631,25 @@ void UART_sendACK(void)
 /*
  * Description :
  * Waits to receive an ACK byte (0xAA) from UART transmitter with timeout.
+ * The deadline covers the whole wait, other bytes do not restart it.
  *
  * Returns:
  *  1 if ACK received successfully, 0 if timeout occurred.
  */
 uint8 UART_waitForACK(void)
 {
-    uint8 ack;
-    uint32 timeout = 0;
+    uint8 ack = 0;
+    uint32 start_ms = Systick_getMs();
+
     do
     {
-        ack = UART_recieveByte();
-        timeout++;
-        if(timeout > TIMEOUT_MAX)
+        if(Systick_isElapsed(start_ms, UART_ACK_TIMEOUT_MS))
+        {
+            UART_recordAckWait(UART_ACK_TIMEOUT_MS);
             return 0; // Timeout error: no ACK received
-    } while(ack != 0xAA);
+        }
+    } while(!UART_tryReceive(&ack, 1) || (ack != 0xAA));
+
+    UART_recordAckWait((uint16)(Systick_getMs() - start_ms));
     return 1; // ACK received
 }
-
@@ -8,11 +8,42 @@
 
 #include"ultrasonic_sensor.h"
 #include"icu.h"
+#include"ext_interrupt.h"
 #include"gpio.h"
 #include"std_types.h"
 #include"common_macros.h"
 #include<util/delay.h>
 
+/*
+ * The echo travels to the obstacle and back at 0.034 cm/us, so the distance
+ * is 0.017 cm per us of echo and one ICU tick lasts 8/F_CPU s. The
+ * conversion multiplies by this reciprocal in fixed point and shifts, with
+ * the largest shift that keeps a 16-bit tick count times the factor in 32 bits.
+ * Longer echoes fit up to ULTRASONIC_MAX_ECHO_TICKS, above they saturate.
+ */
+#define ULTRASONIC_CM_SHIFT            21
+#define ULTRASONIC_MM_SHIFT            18
+#define ULTRASONIC_CM_PER_TICK         ((17ULL * 8000ULL * (1ULL << ULTRASONIC_CM_SHIFT) + F_CPU / 2) / F_CPU)
+#define ULTRASONIC_MM_PER_TICK         ((170ULL * 8000ULL * (1ULL << ULTRASONIC_MM_SHIFT) + F_CPU / 2) / F_CPU)
+#define ULTRASONIC_MAX_ECHO_TICKS      (0xFFFFFFFFUL / ULTRASONIC_MM_PER_TICK)
+#define ULTRASONIC_GUARD_TICKS         ((uint32)ULTRASONIC_GUARD_MS * ULTRASONIC_TICKS_PER_MS)
+
+#if (ULTRASONIC_CM_PER_TICK > 65536) || (ULTRASONIC_MM_PER_TICK > 65536)
+#error "F_CPU too low for the fixed point distance conversion, reduce the shifts"
+#endif
+
+#if (ULTRASONIC_ECHO_TIMEOUT_MS * ULTRASONIC_TICKS_PER_MS) > ULTRASONIC_MAX_ECHO_TICKS
+#error "ULTRASONIC_ECHO_TIMEOUT_MS too long for the fixed point distance conversion"
+#endif
+
+#if ((ULTRASONIC_FILTER_SIZE % 2) == 0) || (ULTRASONIC_FILTER_SIZE > 7)
+#error "ULTRASONIC_FILTER_SIZE must be odd and at most 7"
+#endif
+
+#if (ULTRASONIC_SENSOR_COUNT < 1) || (ULTRASONIC_SENSOR_COUNT > (3 + ULTRASONIC_USE_INT2))
+#error "ULTRASONIC_SENSOR_COUNT must be 1 to 3, or 4 with ULTRASONIC_USE_INT2"
+#endif
+
 /*******************************************************************************
  *                           Global Variables                                  *
  *******************************************************************************/
@@ -20,11 +51,209 @@
 uint8 count = 0;
 /*global variable to hold the value of high time produced by the signal from rising to falling edge.
  */
-uint16 first_high = 0;
+uint32 first_high = 0;
+
+/* Timer1 timestamp of the rising edge of the echo */
+static uint32 g_echoStart = 0;
+
+/* Sensor of the current or last measurement, and when that measurement ended */
+static volatile uint8 g_sensor = 0;
+static volatile uint32 g_lastEnd = 0;
+
+/* Trigger pins of the array, the echo of sensor n > 0 is on external interrupt n - 1 */
+static const uint8 g_trigPortId[4] = { ULTRASONIC_TRIG_PORT_ID, ULTRASONIC_1_TRIG_PORT_ID,
+		ULTRASONIC_2_TRIG_PORT_ID, ULTRASONIC_3_TRIG_PORT_ID };
+static const uint8 g_trigPinId[4] = { ULTRASONIC_TRIG_PIN_ID, ULTRASONIC_1_TRIG_PIN_ID,
+		ULTRASONIC_2_TRIG_PIN_ID, ULTRASONIC_3_TRIG_PIN_ID };
+
+/* State and result of the current measurement, written by the interrupts */
+static volatile Ultrasonic_StatusType g_status = ULTRASONIC_IDLE;
+static volatile uint16 g_lastDistance = 0;
+static volatile uint16 g_lastDistanceMm = 0;
+
+/* Filters behind Ultrasonic_readDistance and their outputs, one per sensor */
+static Ultrasonic_FilterType g_filter[ULTRASONIC_SENSOR_COUNT];
+static uint16 g_sensorDistance[ULTRASONIC_SENSOR_COUNT];
+
+/* Application function called when a measurement ends */
+static void (*volatile g_resultCallBackPtr)(Ultrasonic_StatusType status, uint16 distance) = NULL_PTR;
 
 /*******************************************************************************
  *                      Functions Definitions                                  *
  *******************************************************************************/
+
+/*
+ * Description :
+ * Converts the echo time in ICU ticks to a distance in cm, one 16x32 bit
+ * multiply and a shift instead of a soft-float division.
+ */
+static uint16 Ultrasonic_ticksToCm(uint32 ticks) {
+	if (ticks > ULTRASONIC_MAX_ECHO_TICKS) {
+		ticks = ULTRASONIC_MAX_ECHO_TICKS;
+	}
+	return (uint16)((ticks * (uint32)ULTRASONIC_CM_PER_TICK) >> ULTRASONIC_CM_SHIFT)
+			+ (ULTRASONIC_OFFSET_MM / 10);
+}
+
+/*
+ * Description :
+ * Converts the echo time in ICU ticks to a distance in mm.
+ */
+static uint16 Ultrasonic_ticksToMm(uint32 ticks) {
+	if (ticks > ULTRASONIC_MAX_ECHO_TICKS) {
+		ticks = ULTRASONIC_MAX_ECHO_TICKS;
+	}
+	return (uint16)((ticks * (uint32)ULTRASONIC_MM_PER_TICK) >> ULTRASONIC_MM_SHIFT)
+			+ ULTRASONIC_OFFSET_MM;
+}
+
+/*
+ * Description :
+ * Adds a sample to the median window and returns the new median. The sorted
+ * copy is kept up to date incrementally: the oldest sample is taken out and
+ * the new one inserted, each with one pass over the window, no full sort.
+ * A sample farther than ULTRASONIC_MAX_STEP_CM from the last accepted one
+ * is dropped, unless ULTRASONIC_MAX_REJECTS samples in a row were, then the
+ * jump is real (an obstacle moved in) and the samples go in again.
+ */
+static uint16 Ultrasonic_filterSample(Ultrasonic_FilterType *filter, uint16 sample) {
+	uint16 last, step;
+	uint8 i;
+
+	if (filter->count > 0) {
+		last = filter->ring[(filter->index + ULTRASONIC_FILTER_SIZE - 1) % ULTRASONIC_FILTER_SIZE];
+		step = (sample > last) ? (sample - last) : (last - sample);
+		if ((step > ULTRASONIC_MAX_STEP_CM) && (filter->rejects < ULTRASONIC_MAX_REJECTS)) {
+			filter->rejects++;
+			return filter->output;
+		}
+	}
+	filter->rejects = 0;
+
+	if (ULTRASONIC_FILTER_SIZE == filter->count) {
+		/* Take the oldest sample out of the sorted copy */
+		for (i = 0; filter->sorted[i] != filter->ring[filter->index]; i++)
+			;
+		for (; i < (ULTRASONIC_FILTER_SIZE - 1); i++) {
+			filter->sorted[i] = filter->sorted[i + 1];
+		}
+		filter->count--;
+	}
+
+	filter->ring[filter->index] = sample;
+	filter->index = (filter->index + 1) % ULTRASONIC_FILTER_SIZE;
+
+	/* Insert the new sample behind the smaller ones */
+	for (i = filter->count; (i > 0) && (filter->sorted[i - 1] > sample); i--) {
+		filter->sorted[i] = filter->sorted[i - 1];
+	}
+	filter->sorted[i] = sample;
+	filter->count++;
+
+	/* Until the window is full the upper middle sample, the farther one of two */
+	filter->output = filter->sorted[filter->count / 2];
+
+	return filter->output;
+}
+
+/*
+ * Description :
+ * Sets the edge the echo input of a sensor detects, ICP1 or an external interrupt.
+ */
+static void Ultrasonic_setEchoEdge(uint8 sensor, Icu_EdgeType edge) {
+	if (0 == sensor) {
+		Icu_setEdgeDetectionType(edge);
+	} else {
+		ExtInt_setEdgeDetectionType((ExtInt_IdType)(sensor - 1),
+				(RISING == edge) ? EXT_INT_RISING : EXT_INT_FALLING);
+	}
+}
+
+/*
+ * Description :
+ * Ends the measurement from interrupt context and hands the result over.
+ */
+static void Ultrasonic_finish(Ultrasonic_StatusType status) {
+	Icu_stopTimeout();
+	/* Wait for the rising edge of the next echo */
+	Ultrasonic_setEchoEdge(g_sensor, RISING);
+	count = 0;
+	g_lastEnd = Icu_getTime();
+
+	if (ULTRASONIC_DONE == status) {
+		g_lastDistance = Ultrasonic_ticksToCm(first_high);
+		g_lastDistanceMm = Ultrasonic_ticksToMm(first_high);
+	}
+	g_status = status;
+
+	if (g_resultCallBackPtr != NULL_PTR) {
+		g_resultCallBackPtr(status, g_lastDistance);
+	}
+}
+
+/*
+ * Description :
+ * Measures the echo of a sensor from the timestamps of its two edges.
+ */
+static void Ultrasonic_echoEdge(uint8 sensor, uint32 time) {
+	/*
+	 * Edges outside of a measurement, e.g. the end of a timed out echo, and
+	 * of the sensors not in turn are ignored
+	 */
+	if ((g_status != ULTRASONIC_BUSY) || (sensor != g_sensor)) {
+		return;
+	}
+
+	/*Start calculating the signal period */
+	count++;
+	if (count == 1) {
+		/*
+		 * Timestamp the rising edge, Timer1 keeps running freely so it
+		 * stays usable as a timebase for the timeout and everything else
+		 */
+		g_echoStart = time;
+		/* Detect falling edge */
+		Ultrasonic_setEchoEdge(sensor, FALLING);
+		/* The echo itself must end in time too */
+		Icu_startTimeout(ULTRASONIC_ECHO_TIMEOUT_MS * ULTRASONIC_TICKS_PER_MS);
+	} else if (count == 2) {
+		/* Store the High time value, the unsigned difference holds across the wrap */
+		first_high = time - g_echoStart;
+		Ultrasonic_finish(ULTRASONIC_DONE);
+	}
+}
+
+/*
+ * Description :
+ * External interrupt call backs of sensors 1 to 3. Unlike ICP1 these do not
+ * latch the timer, the time is read in the interrupt and includes its latency,
+ * a few us at worst that is well below 1 cm.
+ */
+static void Ultrasonic_int0Edge(void) {
+	Ultrasonic_echoEdge(1, Icu_getTime());
+}
+
+static void Ultrasonic_int1Edge(void) {
+	Ultrasonic_echoEdge(2, Icu_getTime());
+}
+
+static void Ultrasonic_int2Edge(void) {
+	Ultrasonic_echoEdge(3, Icu_getTime());
+}
+
+static void (*const g_extEdgeCallBack[3])(void) = { Ultrasonic_int0Edge, Ultrasonic_int1Edge,
+		Ultrasonic_int2Edge };
+
+/*
+ * Description :
+ * Timer1 compare call back: no echo started, or it did not end, in time.
+ */
+static void Ultrasonic_timeout(void) {
+	if (ULTRASONIC_BUSY == g_status) {
+		Ultrasonic_finish(ULTRASONIC_OUT_OF_RANGE);
+	}
+}
+
 /*
  * Description :
  * Initialize ICU configuration.
@@ -32,6 +261,8 @@ uint16 first_high = 0;
  * Set PINB5 as output pin, with initial value: LOGIC_LOW.
  */
 void Ultrasonic_init(void) {
+	ExtInt_ConfigType ExtInt_Config;
+	uint8 sensor;
 
 	/*Initializing the ICU configuration:
 	 * Frequency: FCPU/8
@@ -44,12 +275,25 @@ void Ultrasonic_init(void) {
 	 * Ultrasonic_edgeProcessing
 	 */
 	Icu_setCallBack(Ultrasonic_edgeProcessing);
+	Icu_setTimeoutCallBack(Ultrasonic_timeout);
+
+	for (sensor = 0; sensor < ULTRASONIC_SENSOR_COUNT; sensor++) {
+		/*Setup the direction for the trigger pin as output pin through the GPIO driver*/
+		GPIO_setupPinDirection(g_trigPortId[sensor], g_trigPinId[sensor], PIN_OUTPUT);
+		/*Initialize the pin value*/
+		GPIO_writePin(g_trigPortId[sensor], g_trigPinId[sensor], LOGIC_LOW);
 
-	/*Setup the direction for the trigger pin as output pin through the GPIO driver*/
-	GPIO_setupPinDirection(ULTRASONIC_TRIG_PORT_ID, ULTRASONIC_TRIG_PIN_ID, PIN_OUTPUT);
-	/*Initialize the pin value*/
-	GPIO_writePin(ULTRASONIC_TRIG_PORT_ID, ULTRASONIC_TRIG_PIN_ID, LOGIC_LOW);
+		/* The echo of the other sensors on the external interrupts, rising edge first */
+		if (sensor > 0) {
+			ExtInt_Config.id = (ExtInt_IdType)(sensor - 1);
+			ExtInt_Config.edge = EXT_INT_RISING;
+			ExtInt_setCallBack(ExtInt_Config.id, g_extEdgeCallBack[sensor - 1]);
+			ExtInt_init(&ExtInt_Config);
+		}
 
+		g_sensorDistance[sensor] = ULTRASONIC_MAX_DISTANCE_CM;
+	}
+	g_sensor = 0;
 }
 
 /*
@@ -59,36 +303,124 @@ void Ultrasonic_init(void) {
  *
  */
 void Ultrasonic_Trigger(void) {
-	/*Writing logic high to pinD5*/
-	GPIO_writePin(ULTRASONIC_TRIG_PORT_ID, ULTRASONIC_TRIG_PIN_ID, LOGIC_HIGH);
+	/*Writing logic high to the trigger pin*/
+	GPIO_writePin(g_trigPortId[g_sensor], g_trigPinId[g_sensor], LOGIC_HIGH);
 
 	_delay_us(10);
 
-	/*Writing logic low to pinD5 to end the trigger pulse*/
-	GPIO_writePin(ULTRASONIC_TRIG_PORT_ID, ULTRASONIC_TRIG_PIN_ID, LOGIC_LOW);
+	/*Writing logic low to the trigger pin to end the trigger pulse*/
+	GPIO_writePin(g_trigPortId[g_sensor], g_trigPinId[g_sensor], LOGIC_LOW);
 }
 
 /*
  * Description :
- * Calls the trigger function to generate a 10us pulse.
- * Polling until the value of the first_high is updated.
- * distance = first_high /58.8.
- * return distance.
+ * Arms the echo timeout before the trigger, so a missing echo ends the
+ * measurement too. Never waits for the guard time, the caller retries.
  */
-uint16 Ultrasonic_readDistance(void) {
-	/*Send the trigger pulse by using Ultrasonic_Trigger function*/
-	uint16 distance;
+boolean Ultrasonic_startMeasurement(void) {
+	if (ULTRASONIC_BUSY == g_status) {
+		return FALSE;
+	}
+
+#if ULTRASONIC_SENSOR_COUNT > 1
+	/*
+	 * g_lastEnd only changes while a measurement is busy, so it is stable
+	 * here. The next sensor is not taken before the guard time passed.
+	 */
+	if ((Icu_getTime() - g_lastEnd) < ULTRASONIC_GUARD_TICKS) {
+		return FALSE;
+	}
+	/* Round robin, one sensor at a time so the echoes never overlap */
+	g_sensor = (g_sensor + 1) % ULTRASONIC_SENSOR_COUNT;
+#endif
+
+	count = 0;
+	Ultrasonic_setEchoEdge(g_sensor, RISING);
+	g_status = ULTRASONIC_BUSY;
+	Icu_startTimeout(ULTRASONIC_ECHO_TIMEOUT_MS * ULTRASONIC_TICKS_PER_MS);
+
 	Ultrasonic_Trigger();
 
-	while (first_high == 0)
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Reports the state and hands a finished result over once.
+ */
+Ultrasonic_StatusType Ultrasonic_poll(uint16 *distance) {
+	Ultrasonic_StatusType status = g_status;
+
+	if (ULTRASONIC_DONE == status) {
+		*distance = g_lastDistance;
+		g_status = ULTRASONIC_IDLE;
+	} else if (ULTRASONIC_OUT_OF_RANGE == status) {
+		g_status = ULTRASONIC_IDLE;
+	}
+
+	return status;
+}
+
+/*
+ * Description :
+ * Saves the application function called when a measurement ends.
+ */
+void Ultrasonic_setCallBack(void (*a_ptr)(Ultrasonic_StatusType status, uint16 distance)) {
+	g_resultCallBackPtr = a_ptr;
+}
+
+/*
+ * Description :
+ * Returns the mm value of the last finished measurement.
+ */
+uint16 Ultrasonic_getLastDistanceMm(void) {
+	return g_lastDistanceMm;
+}
+
+/*
+ * Description :
+ * Starts a measurement unless one is in progress or finished unread, then
+ * polls until the echo or the timeout ends it and filters the sample into
+ * the table of its sensor. The nearest obstacle of the table is returned.
+ */
+uint16 Ultrasonic_readDistance(void) {
+	uint16 distance = ULTRASONIC_MAX_DISTANCE_CM;
+	uint16 nearest;
+	uint8 sensor;
+
+	/* Idle, it can only fail for the guard time, which ends by itself */
+	if (ULTRASONIC_IDLE == g_status) {
+		while (!Ultrasonic_startMeasurement())
+			;
+	}
+
+	/* Sensor of the measurement about to be read */
+	sensor = g_sensor;
+
+	while (ULTRASONIC_BUSY == Ultrasonic_poll(&distance))
 		;
 
-	//  while(1){LCD_intgerToString(first_high);_delay_ms(1241224);}
-	distance = ((float) first_high / 58.823529) + 1;
+	g_sensorDistance[sensor] = Ultrasonic_filterSample(&g_filter[sensor], distance);
 
-	first_high = 0;
+	nearest = g_sensorDistance[0];
+	for (sensor = 1; sensor < ULTRASONIC_SENSOR_COUNT; sensor++) {
+		if (g_sensorDistance[sensor] < nearest) {
+			nearest = g_sensorDistance[sensor];
+		}
+	}
 
-	return distance;
+	return nearest;
+}
+
+/*
+ * Description :
+ * Returns one entry of the per sensor table.
+ */
+uint16 Ultrasonic_getSensorDistance(uint8 sensor) {
+	if (sensor >= ULTRASONIC_SENSOR_COUNT) {
+		return ULTRASONIC_MAX_DISTANCE_CM;
+	}
+	return g_sensorDistance[sensor];
 }
 
 /*
@@ -97,22 +429,6 @@ uint16 Ultrasonic_readDistance(void) {
  * Updates the value of first_high from rising to falling edge.
  */
 void Ultrasonic_edgeProcessing(void) {
-	/*Start calculating the signal period */
-	count++;
-	if (count == 1) {
-		/*
-		 * Clear the timer counter register to start measurements from the
-		 * first detected rising edge
-		 */
-		Icu_clearTimerValue();
-		/* Detect falling edge */
-		Icu_setEdgeDetectionType(FALLING);
-	} else if (count == 2) {
-		/* Store the High time value */
-		first_high = Icu_getInputCaptureValue();
-		/* Detect rising edge */
-		Icu_setEdgeDetectionType(RISING);
-		count = 0;
-	}
-
+	/* Sensor 0, ICP1 latched the time of the edge */
+	Ultrasonic_echoEdge(0, Icu_getCaptureTime());
 }
@@ -19,6 +19,63 @@ extern uint16 g_distance;
 #define ULTRASONIC_ECO_PORT_ID         PORTD_ID
 #define ULTRASONIC_ECO_PIN_ID          PIN6_ID
 
+// Sensor array: sensor 0 is the one above with its echo on ICP1, sensors 1, 2
+// and 3 have their echo on INT0/PD2, INT1/PD3 and INT2/PB2. 1 is a single sensor
+#define ULTRASONIC_SENSOR_COUNT        1
+
+// INT2/PB2 is DC motor 2 IN1, set to 1 for a fourth sensor only after moving it
+#define ULTRASONIC_USE_INT2            0
+
+// Trigger pins of sensors 1, 2 and 3
+#define ULTRASONIC_1_TRIG_PORT_ID      PORTD_ID
+#define ULTRASONIC_1_TRIG_PIN_ID       PIN4_ID
+#define ULTRASONIC_2_TRIG_PORT_ID      PORTD_ID
+#define ULTRASONIC_2_TRIG_PIN_ID       PIN5_ID
+#define ULTRASONIC_3_TRIG_PORT_ID      PORTB_ID
+#define ULTRASONIC_3_TRIG_PIN_ID       PIN5_ID
+
+// Quiet time between the end of a measurement and the trigger of the next
+// sensor, so a late echo of one burst is not taken for the next sensor's
+#define ULTRASONIC_GUARD_MS            10
+
+// ICU counts at F_CPU/8
+#define ULTRASONIC_TICKS_PER_MS        (F_CPU / 8000UL)
+
+// Farthest distance the HC-SR04 measures, reported when the echo times out
+#define ULTRASONIC_MAX_DISTANCE_CM     400
+
+// Calibration added to every measured distance, the sensor reads about 1 cm short
+#define ULTRASONIC_OFFSET_MM           10
+
+// Longest wait for the echo to start and for the echo itself (400 cm take 23.5 ms)
+#define ULTRASONIC_ECHO_TIMEOUT_MS     25
+
+// Running median window of Ultrasonic_readDistance, 3 or 5 samples
+#define ULTRASONIC_FILTER_SIZE         5
+
+// Largest plausible change from the last accepted sample
+#define ULTRASONIC_MAX_STEP_CM         50
+
+// Implausible samples in a row dropped before the jump is taken as real
+#define ULTRASONIC_MAX_REJECTS         2
+
+// State of the current measurement
+typedef enum {
+	ULTRASONIC_IDLE,            // No measurement started, or its result was read
+	ULTRASONIC_BUSY,            // Waiting for the echo
+	ULTRASONIC_DONE,            // Distance measured
+	ULTRASONIC_OUT_OF_RANGE     // No echo, or no end of the echo, before the timeout
+} Ultrasonic_StatusType;
+
+// Median filter state, the samples in arrival order and the same samples sorted
+typedef struct {
+	uint16 ring[ULTRASONIC_FILTER_SIZE];
+	uint16 sorted[ULTRASONIC_FILTER_SIZE];
+	uint8 index;                // Next ring slot, holds the oldest sample once full
+	uint8 count;                // Samples in the window
+	uint8 rejects;              // Implausible samples dropped in a row
+	uint16 output;              // Last filtered distance
+} Ultrasonic_FilterType;
 
 // Function prototypes for ultrasonic sensor operations
 
@@ -43,7 +100,7 @@ void Ultrasonic_edgeProcessing(void);
 
 /*
 * Description :
-* This function is used to generate a 10us trigger.
+* This function is used to generate a 10us trigger on the sensor in turn.
 * Set PORTB5 as LOGIC_HIGH , then delay , then set PORTB5 as LOGIC_LOW.
 *
 */
@@ -51,12 +108,58 @@ void Ultrasonic_Trigger(void);
 
 /*
 * Description :
-* Calls the trigger function to generate a 10us pulse.
-* Polling until the value of the first_high is updated.
-* distance = first_high /58.8.
-* return distance.
+* Starts a measurement and returns at once, the ICU interrupt measures the
+* echo and the Timer1 compare interrupt ends it after ULTRASONIC_ECHO_TIMEOUT_MS.
+* With several sensors only one measures at a time, each start triggers the
+* next sensor in turn once ULTRASONIC_GUARD_MS passed since the last one ended.
+* Returns FALSE if a measurement is still in progress, or without triggering
+* while the guard time has not passed yet; the caller simply tries again later.
+*/
+boolean Ultrasonic_startMeasurement(void);
+
+/*
+* Description :
+* Non-blocking check of the measurement. Returns its state, on
+* ULTRASONIC_DONE distance is filled. DONE and OUT_OF_RANGE are reported
+* once, the state is IDLE afterwards.
+*/
+Ultrasonic_StatusType Ultrasonic_poll(uint16 *distance);
+
+/*
+* Description :
+* Sets a function called from the interrupt when a measurement ends,
+* with ULTRASONIC_DONE and the distance or ULTRASONIC_OUT_OF_RANGE.
+* The result can still be read with Ultrasonic_poll.
+*/
+void Ultrasonic_setCallBack(void (*a_ptr)(Ultrasonic_StatusType status, uint16 distance));
+
+/*
+* Description :
+* Returns the distance of the last finished measurement in mm, for a
+* finer resolution than the cm value.
+*/
+uint16 Ultrasonic_getLastDistanceMm(void);
+
+/*
+* Description :
+* Blocking measurement: finishes the one started by Ultrasonic_startMeasurement,
+* or starts one. Waits at most ULTRASONIC_GUARD_MS plus about twice
+* ULTRASONIC_ECHO_TIMEOUT_MS and takes ULTRASONIC_MAX_DISTANCE_CM if the
+* echo timed out.
+* Returns the running median of the last ULTRASONIC_FILTER_SIZE plausible
+* samples, so a single spurious echo does not show up as an obstacle.
+* Ultrasonic_poll and the call back report the raw samples.
+* With several sensors each call measures the next one and returns the
+* nearest of the filtered distances of all sensors.
 */
 uint16 Ultrasonic_readDistance(void);
 
+/*
+* Description :
+* Returns the filtered distance of one sensor of the array as last measured by
+* Ultrasonic_readDistance, ULTRASONIC_MAX_DISTANCE_CM until it was measured.
+*/
+uint16 Ultrasonic_getSensorDistance(uint8 sensor);
+
 
 #endif /* ULTRASONIC_SENSOR_H_ */
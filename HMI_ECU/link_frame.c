@@ -0,0 +1,737 @@
+/*
+ * link_frame.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "link_frame.h"
+#include "uart.h"
+#include "systick.h"
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/*
+ * COBS decoder state is kept between calls so frames can arrive in pieces.
+ * g_rxCode is the code byte of the current block, 0xFF before the first block
+ * so no zero is added in front of it. g_rxRemaining counts the data bytes
+ * still expected in the block, 0 means the next byte is a code byte.
+ */
+static uint8 g_rxBuffer[LINK_FRAME_MAX_SIZE];
+static uint8 g_rxIndex = 0;
+static uint8 g_rxCode = 0xFF;
+static uint8 g_rxRemaining = 0;
+static boolean g_rxOverflow = FALSE;
+
+/* Transmit buffer, read by the UART interrupt until the frame is out */
+static uint8 g_txFrame[LINK_FRAME_MAX_ENCODED_SIZE];
+
+/* Frame received while waiting for an ACK, handed out by the next poll */
+static LinkFrame_Type g_pendingFrame;
+static boolean g_pendingValid = FALSE;
+
+/* Type and sequence number of the last accepted reliable frame, 0x100 means none yet */
+static uint8 g_lastReliableType = 0;
+static uint16 g_lastReliableSeq = 0x100;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Drops the frame being decoded, the next byte starts a new frame.
+ */
+static void LinkFrame_resetDecoder(void)
+{
+    g_rxIndex = 0;
+    g_rxCode = 0xFF;
+    g_rxRemaining = 0;
+    g_rxOverflow = FALSE;
+}
+
+/*
+ * Description :
+ * Resets the receive decoder and makes an idle line end a frame.
+ */
+void LinkFrame_init(void)
+{
+    LinkFrame_resetDecoder();
+    g_pendingValid = FALSE;
+    g_lastReliableSeq = 0x100;
+    UART_setIdleDelimiter(LINK_FRAME_IDLE_MS);
+}
+
+/*
+ * Description :
+ * Bitwise CRC-8 with polynomial x^8 + x^2 + x + 1 (0x07).
+ * Pass the previous result as crc to continue over several buffers.
+ */
+uint8 LinkFrame_crc8(uint8 crc, const uint8 *data, uint8 length)
+{
+    uint8 i, bit;
+
+    for(i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for(bit = 0; bit < 8; bit++)
+        {
+            if(crc & 0x80)
+            {
+                crc = (crc << 1) ^ 0x07;
+            }
+            else
+            {
+                crc <<= 1;
+            }
+        }
+    }
+
+    return crc;
+}
+
+/*
+ * Description :
+ * COBS encodes length bytes of source into destination, which must hold
+ * length + length / 254 + 1 bytes. Returns the encoded size without delimiter.
+ */
+static uint8 LinkFrame_cobsEncode(const uint8 *source, uint8 length, uint8 *destination)
+{
+    uint8 read_index = 0;
+    uint8 write_index = 1;
+    uint8 code_index = 0;
+    uint8 code = 1;
+
+    while(read_index < length)
+    {
+        if(0 == source[read_index])
+        {
+            /* Close the block, its code byte points at this zero */
+            destination[code_index] = code;
+            code = 1;
+            code_index = write_index++;
+        }
+        else
+        {
+            destination[write_index++] = source[read_index];
+            code++;
+            if(0xFF == code)
+            {
+                /* Longest block, the next one does not imply a zero */
+                destination[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+            }
+        }
+        read_index++;
+    }
+    destination[code_index] = code;
+
+    return write_index;
+}
+
+/*
+ * Description :
+ * Builds the header and CRC around the payload, COBS encodes it into the
+ * transmit buffer and hands the whole frame to the UART as one zero-copy transfer.
+ */
+boolean LinkFrame_sendAsync(uint8 type, uint8 seq, const uint8 *payload, uint8 length, void (*done)(void))
+{
+    uint8 frame[LINK_FRAME_MAX_SIZE];
+    uint8 encoded_length;
+    uint8 i;
+
+    /* The buffer still belongs to the UART interrupt */
+    if(UART_isAsyncBusy())
+    {
+        return FALSE;
+    }
+
+    if(length > LINK_FRAME_MAX_PAYLOAD)
+    {
+        length = LINK_FRAME_MAX_PAYLOAD;
+    }
+
+    frame[0] = type;
+    frame[1] = length;
+    frame[2] = seq;
+    for(i = 0; i < length; i++)
+    {
+        frame[LINK_FRAME_HEADER_SIZE + i] = payload[i];
+    }
+    frame[LINK_FRAME_HEADER_SIZE + length] = LinkFrame_crc8(0, frame, LINK_FRAME_HEADER_SIZE + length);
+
+    encoded_length = LinkFrame_cobsEncode(frame, LINK_FRAME_HEADER_SIZE + length + 1, g_txFrame);
+    g_txFrame[encoded_length] = LINK_FRAME_DELIMITER;
+
+    return UART_sendBufferAsync(g_txFrame, encoded_length + 1, done);
+}
+
+/*
+ * Description :
+ * Sends a frame, waiting only for the previous frame to leave the buffer.
+ */
+void LinkFrame_send(uint8 type, uint8 seq, const uint8 *payload, uint8 length)
+{
+    while(!LinkFrame_sendAsync(type, seq, payload, length, NULL_PTR)) {}
+}
+
+/*
+ * Description :
+ * Copies a frame including its payload.
+ */
+static void LinkFrame_copy(LinkFrame_Type *destination, const LinkFrame_Type *source)
+{
+    uint8 i;
+
+    destination->type = source->type;
+    destination->length = source->length;
+    destination->seq = source->seq;
+    for(i = 0; i < source->length; i++)
+    {
+        destination->payload[i] = source->payload[i];
+    }
+}
+
+/*
+ * Description :
+ * Checks a decoded frame ended by a delimiter and copies it out.
+ * Returns FALSE for empty, cut or corrupted frames.
+ */
+static boolean LinkFrame_accept(LinkFrame_Type *frame)
+{
+    uint8 i;
+    uint8 length;
+
+    /* A block still expecting data bytes means the frame was cut short */
+    if(g_rxOverflow || (g_rxRemaining != 0) || (g_rxIndex < LINK_FRAME_HEADER_SIZE + 1))
+    {
+        return FALSE;
+    }
+
+    length = g_rxBuffer[1];
+    if((length > LINK_FRAME_MAX_PAYLOAD) || (g_rxIndex != LINK_FRAME_HEADER_SIZE + length + 1))
+    {
+        return FALSE;
+    }
+
+    if(LinkFrame_crc8(0, g_rxBuffer, g_rxIndex - 1) != g_rxBuffer[g_rxIndex - 1])
+    {
+        return FALSE;
+    }
+
+    frame->type = g_rxBuffer[0];
+    frame->length = length;
+    frame->seq = g_rxBuffer[2];
+    for(i = 0; i < length; i++)
+    {
+        frame->payload[i] = g_rxBuffer[LINK_FRAME_HEADER_SIZE + i];
+    }
+
+    return TRUE;
+}
+
+/*
+ * Description :
+ * Stores one decoded byte, a frame too long for the buffer is dropped
+ * at its delimiter.
+ */
+static void LinkFrame_store(uint8 data)
+{
+    if(g_rxIndex < LINK_FRAME_MAX_SIZE)
+    {
+        g_rxBuffer[g_rxIndex++] = data;
+    }
+    else
+    {
+        g_rxOverflow = TRUE;
+    }
+}
+
+/*
+ * Description :
+ * Runs the COBS decoder over all bytes waiting in the UART RX buffer.
+ * Every 0x00 (sent after each frame or stored by the UART on an idle line)
+ * ends the frame being decoded, so a corrupted frame costs only itself.
+ */
+static boolean LinkFrame_parse(LinkFrame_Type *frame)
+{
+    uint8 data;
+    boolean accepted;
+
+    while(UART_tryReceive(&data, 1))
+    {
+        if(LINK_FRAME_DELIMITER == data)
+        {
+            accepted = LinkFrame_accept(frame);
+            LinkFrame_resetDecoder();
+            if(accepted)
+            {
+                return TRUE;
+            }
+        }
+        else if(0 == g_rxRemaining)
+        {
+            /* Code byte: the previous block ended with a zero unless it was full */
+            if(g_rxCode != 0xFF)
+            {
+                LinkFrame_store(0);
+            }
+            g_rxCode = data;
+            g_rxRemaining = data - 1;
+        }
+        else
+        {
+            LinkFrame_store(data);
+            g_rxRemaining--;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Returns the frame put aside while waiting for an ACK first,
+ * then continues with the bytes waiting in the UART RX buffer.
+ */
+boolean LinkFrame_poll(LinkFrame_Type *frame)
+{
+    if(g_pendingValid)
+    {
+        g_pendingValid = FALSE;
+        LinkFrame_copy(frame, &g_pendingFrame);
+        return TRUE;
+    }
+
+    return LinkFrame_parse(frame);
+}
+
+/*
+ * Description :
+ * Stores the frame in the slot LinkFrame_poll returns first.
+ */
+void LinkFrame_putBack(const LinkFrame_Type *frame)
+{
+    LinkFrame_copy(&g_pendingFrame, frame);
+    g_pendingValid = TRUE;
+}
+
+/*
+ * Description :
+ * Waits until a complete valid frame is received.
+ */
+void LinkFrame_receive(LinkFrame_Type *frame)
+{
+    while(!LinkFrame_poll(frame)) {}
+}
+
+/*
+ * Description :
+ * Waits for a complete valid frame until the deadline passes.
+ */
+boolean LinkFrame_receiveTimeout(LinkFrame_Type *frame, uint16 timeout_ms)
+{
+    uint32 start_ms = Systick_getMs();
+
+    do
+    {
+        if(LinkFrame_poll(frame))
+        {
+            return TRUE;
+        }
+    } while(!Systick_isElapsed(start_ms, timeout_ms));
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Sends a one byte payload frame, these frames are not acknowledged.
+ */
+void LinkFrame_sendValue(uint8 type, uint8 value)
+{
+    LinkFrame_send(type, 0, &value, 1);
+}
+
+/*
+ * Description :
+ * Waits for a one byte payload frame of the given type until the deadline passes.
+ */
+boolean LinkFrame_receiveValue(uint8 type, uint8 *value, uint16 timeout_ms)
+{
+    LinkFrame_Type frame;
+    uint32 start_ms = Systick_getMs();
+
+    do
+    {
+        if(LinkFrame_poll(&frame) && (frame.type == type) && (frame.length > 0))
+        {
+            *value = frame.payload[0];
+            return TRUE;
+        }
+    } while(!Systick_isElapsed(start_ms, timeout_ms));
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Sends an empty ACK frame carrying the acknowledged sequence number.
+ */
+void LinkFrame_sendAck(uint8 seq)
+{
+    LinkFrame_send(LINK_FRAME_TYPE_ACK, seq, NULL_PTR, 0);
+}
+
+/*
+ * Description :
+ * Waits for the ACK of the given sequence number until the deadline passes.
+ * Stale ACKs are dropped, any other frame is kept for the next receive.
+ */
+boolean LinkFrame_waitForAck(uint8 seq)
+{
+    LinkFrame_Type frame;
+    uint32 start_ms = Systick_getMs();
+
+    do
+    {
+        if(LinkFrame_parse(&frame))
+        {
+            if(frame.type == LINK_FRAME_TYPE_ACK)
+            {
+                if(frame.seq == seq)
+                {
+                    UART_recordAckWait((uint16)(Systick_getMs() - start_ms));
+                    return TRUE;
+                }
+            }
+            else
+            {
+                LinkFrame_copy(&g_pendingFrame, &frame);
+                g_pendingValid = TRUE;
+            }
+        }
+    } while(!Systick_isElapsed(start_ms, LINK_FRAME_ACK_TIMEOUT_MS));
+
+    UART_recordAckWait(LINK_FRAME_ACK_TIMEOUT_MS);
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Stop-and-wait transmit with a bounded number of retransmissions.
+ */
+boolean LinkFrame_sendReliable(uint8 type, uint8 seq, const uint8 *payload, uint8 length)
+{
+    uint8 attempt;
+
+    for(attempt = 0; attempt <= LINK_FRAME_MAX_RETRIES; attempt++)
+    {
+        if(attempt > 0)
+        {
+            UART_recordRetransmit();
+        }
+        LinkFrame_send(type, seq, payload, length);
+        if(LinkFrame_waitForAck(seq))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Acknowledges every copy of a reliable frame but hands out only the first
+ * one, so a lost ACK does not make the application process a frame twice.
+ */
+boolean LinkFrame_receiveReliable(uint8 type, LinkFrame_Type *frame, uint16 timeout_ms)
+{
+    uint32 start_ms = Systick_getMs();
+
+    do
+    {
+        if(LinkFrame_poll(frame) && (frame->type == type))
+        {
+            LinkFrame_sendAck(frame->seq);
+            if((frame->seq != g_lastReliableSeq) || (frame->type != g_lastReliableType))
+            {
+                g_lastReliableType = frame->type;
+                g_lastReliableSeq = frame->seq;
+                return TRUE;
+            }
+        }
+    } while(!Systick_isElapsed(start_ms, timeout_ms));
+
+    return FALSE;
+}
+
+/*
+ * Description :
+ * Serializes a telemetry snapshot, multi-byte values are sent high byte first.
+ */
+void LinkFrame_packTelemetry(const LinkFrame_TelemetryType *telemetry, uint8 *payload)
+{
+    payload[0] = telemetry->temperature;
+    payload[1] = (uint8)(telemetry->distance >> 8);
+    payload[2] = (uint8)(telemetry->distance & 0xFF);
+    payload[3] = telemetry->window1_state;
+    payload[4] = telemetry->window2_state;
+    payload[5] = telemetry->dist_error_counter;
+    payload[6] = telemetry->temp_error_counter;
+}
+
+/*
+ * Description :
+ * Deserializes a telemetry snapshot packed by LinkFrame_packTelemetry.
+ */
+void LinkFrame_unpackTelemetry(const uint8 *payload, LinkFrame_TelemetryType *telemetry)
+{
+    telemetry->temperature = payload[0];
+    telemetry->distance = ((uint16)payload[1] << 8) | payload[2];
+    telemetry->window1_state = payload[3];
+    telemetry->window2_state = payload[4];
+    telemetry->dist_error_counter = payload[5];
+    telemetry->temp_error_counter = payload[6];
+}
+
+/*
+ * Description :
+ * Writes a 16/32-bit value high byte first.
+ */
+static void LinkFrame_putUint16(uint8 *payload, uint16 value)
+{
+    payload[0] = (uint8)(value >> 8);
+    payload[1] = (uint8)value;
+}
+
+static void LinkFrame_putUint32(uint8 *payload, uint32 value)
+{
+    LinkFrame_putUint16(&payload[0], (uint16)(value >> 16));
+    LinkFrame_putUint16(&payload[2], (uint16)value);
+}
+
+/*
+ * Description :
+ * Reads a 16/32-bit value sent high byte first.
+ */
+static uint16 LinkFrame_getUint16(const uint8 *payload)
+{
+    return ((uint16)payload[0] << 8) | payload[1];
+}
+
+static uint32 LinkFrame_getUint32(const uint8 *payload)
+{
+    return ((uint32)LinkFrame_getUint16(&payload[0]) << 16) | LinkFrame_getUint16(&payload[2]);
+}
+
+/*
+ * Description :
+ * Serializes the link statistics, multi-byte values are sent high byte first.
+ */
+void LinkFrame_packStats(const UART_StatsType *stats, uint8 *payload)
+{
+    LinkFrame_putUint32(&payload[0], stats->bytes_in);
+    LinkFrame_putUint32(&payload[4], stats->bytes_out);
+    LinkFrame_putUint16(&payload[8], stats->overruns);
+    LinkFrame_putUint16(&payload[10], stats->framing_errors);
+    LinkFrame_putUint16(&payload[12], stats->parity_errors);
+    LinkFrame_putUint16(&payload[14], stats->rx_buffer_drops);
+    LinkFrame_putUint16(&payload[16], stats->retransmits);
+    LinkFrame_putUint16(&payload[18], stats->max_ack_wait_ticks);
+}
+
+/*
+ * Description :
+ * Deserializes link statistics packed by LinkFrame_packStats.
+ */
+void LinkFrame_unpackStats(const uint8 *payload, UART_StatsType *stats)
+{
+    stats->bytes_in = LinkFrame_getUint32(&payload[0]);
+    stats->bytes_out = LinkFrame_getUint32(&payload[4]);
+    stats->overruns = LinkFrame_getUint16(&payload[8]);
+    stats->framing_errors = LinkFrame_getUint16(&payload[10]);
+    stats->parity_errors = LinkFrame_getUint16(&payload[12]);
+    stats->rx_buffer_drops = LinkFrame_getUint16(&payload[14]);
+    stats->retransmits = LinkFrame_getUint16(&payload[16]);
+    stats->max_ack_wait_ticks = LinkFrame_getUint16(&payload[18]);
+}
+
+/*
+ * Description :
+ * Serializes a push subscription, the interval is sent high byte first.
+ */
+void LinkFrame_packSubscribe(const LinkFrame_SubscribeType *subscribe, uint8 *payload)
+{
+    payload[0] = subscribe->temperature_deadband;
+    payload[1] = subscribe->distance_deadband;
+    LinkFrame_putUint16(&payload[2], subscribe->max_interval_ms);
+}
+
+/*
+ * Description :
+ * Deserializes a push subscription packed by LinkFrame_packSubscribe.
+ */
+void LinkFrame_unpackSubscribe(const uint8 *payload, LinkFrame_SubscribeType *subscribe)
+{
+    subscribe->temperature_deadband = payload[0];
+    subscribe->distance_deadband = payload[1];
+    subscribe->max_interval_ms = LinkFrame_getUint16(&payload[2]);
+}
+
+/*
+ * Description :
+ * Returns the number of payload bytes a push frame with these fields needs.
+ */
+static uint8 LinkFrame_deltaLength(uint8 fields)
+{
+    uint8 length = 1;
+
+    if(fields & LINK_FRAME_FIELD_TEMPERATURE)
+    {
+        length++;
+    }
+    if(fields & LINK_FRAME_FIELD_DISTANCE)
+    {
+        length += 2;
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW1)
+    {
+        length++;
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW2)
+    {
+        length++;
+    }
+    if(fields & LINK_FRAME_FIELD_DIST_ERRORS)
+    {
+        length++;
+    }
+    if(fields & LINK_FRAME_FIELD_TEMP_ERRORS)
+    {
+        length++;
+    }
+
+    return length;
+}
+
+/*
+ * Description :
+ * Serializes the selected telemetry fields behind their bitmask.
+ */
+uint8 LinkFrame_packDelta(const LinkFrame_TelemetryType *telemetry, uint8 fields, uint8 *payload)
+{
+    uint8 length = 1;
+
+    fields &= LINK_FRAME_FIELD_ALL;
+    payload[0] = fields;
+    if(fields & LINK_FRAME_FIELD_TEMPERATURE)
+    {
+        payload[length++] = telemetry->temperature;
+    }
+    if(fields & LINK_FRAME_FIELD_DISTANCE)
+    {
+        LinkFrame_putUint16(&payload[length], telemetry->distance);
+        length += 2;
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW1)
+    {
+        payload[length++] = telemetry->window1_state;
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW2)
+    {
+        payload[length++] = telemetry->window2_state;
+    }
+    if(fields & LINK_FRAME_FIELD_DIST_ERRORS)
+    {
+        payload[length++] = telemetry->dist_error_counter;
+    }
+    if(fields & LINK_FRAME_FIELD_TEMP_ERRORS)
+    {
+        payload[length++] = telemetry->temp_error_counter;
+    }
+
+    return length;
+}
+
+/*
+ * Description :
+ * Applies a push frame payload packed by LinkFrame_packDelta.
+ */
+uint8 LinkFrame_unpackDelta(const uint8 *payload, uint8 length, LinkFrame_TelemetryType *telemetry)
+{
+    uint8 fields;
+    uint8 index = 1;
+
+    if((0 == length) || (payload[0] & (uint8)~LINK_FRAME_FIELD_ALL) || (LinkFrame_deltaLength(payload[0]) != length))
+    {
+        return 0;
+    }
+
+    fields = payload[0];
+    if(fields & LINK_FRAME_FIELD_TEMPERATURE)
+    {
+        telemetry->temperature = payload[index++];
+    }
+    if(fields & LINK_FRAME_FIELD_DISTANCE)
+    {
+        telemetry->distance = LinkFrame_getUint16(&payload[index]);
+        index += 2;
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW1)
+    {
+        telemetry->window1_state = payload[index++];
+    }
+    if(fields & LINK_FRAME_FIELD_WINDOW2)
+    {
+        telemetry->window2_state = payload[index++];
+    }
+    if(fields & LINK_FRAME_FIELD_DIST_ERRORS)
+    {
+        telemetry->dist_error_counter = payload[index++];
+    }
+    if(fields & LINK_FRAME_FIELD_TEMP_ERRORS)
+    {
+        telemetry->temp_error_counter = payload[index++];
+    }
+
+    return fields;
+}
+
+/*
+ * Description :
+ * Serializes a logged DTC event, multi-byte values are sent high byte first.
+ */
+void LinkFrame_packFreezeFrame(const LinkFrame_FreezeFrameType *freeze_frame, uint8 *payload)
+{
+    payload[0] = freeze_frame->dtc;
+    payload[1] = freeze_frame->index;
+    LinkFrame_putUint16(&payload[2], freeze_frame->count);
+    payload[4] = freeze_frame->temperature;
+    LinkFrame_putUint16(&payload[5], freeze_frame->distance);
+    payload[7] = freeze_frame->window1_state;
+    payload[8] = freeze_frame->window2_state;
+    LinkFrame_putUint16(&payload[9], freeze_frame->since_last_s);
+    LinkFrame_putUint32(&payload[11], freeze_frame->uptime_s);
+}
+
+/*
+ * Description :
+ * Deserializes a logged DTC event packed by LinkFrame_packFreezeFrame.
+ */
+void LinkFrame_unpackFreezeFrame(const uint8 *payload, LinkFrame_FreezeFrameType *freeze_frame)
+{
+    freeze_frame->dtc = payload[0];
+    freeze_frame->index = payload[1];
+    freeze_frame->count = LinkFrame_getUint16(&payload[2]);
+    freeze_frame->temperature = payload[4];
+    freeze_frame->distance = LinkFrame_getUint16(&payload[5]);
+    freeze_frame->window1_state = payload[7];
+    freeze_frame->window2_state = payload[8];
+    freeze_frame->since_last_s = LinkFrame_getUint16(&payload[9]);
+    freeze_frame->uptime_s = LinkFrame_getUint32(&payload[11]);
+}
@@ -0,0 +1,304 @@
+/*
+ * link_frame.h
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#ifndef LINK_FRAME_H_
+#define LINK_FRAME_H_
+
+#include "std_types.h"
+#include "uart.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Frame layout on the UART link between the two ECUs:
+ *
+ *   | COBS( TYPE | LEN | SEQ | PAYLOAD (LEN bytes) | CRC8 ) | 0x00 |
+ *
+ * CRC8 (polynomial 0x07) covers TYPE, LEN, SEQ and the payload.
+ * COBS encoding removes every 0x00 from the frame, so 0x00 only ever shows
+ * up as the frame delimiter and the receiver resyncs on the next one.
+ * A line idle for LINK_FRAME_IDLE_MS also ends a frame (see
+ * UART_setIdleDelimiter), so a frame cut short by noise is dropped at the
+ * gap instead of swallowing the start of the next frame.
+ */
+#define LINK_FRAME_DELIMITER        UART_IDLE_DELIMITER
+#define LINK_FRAME_HEADER_SIZE      3
+#define LINK_FRAME_MAX_PAYLOAD      32
+
+/* Decoded frame size: header, payload and CRC */
+#define LINK_FRAME_MAX_SIZE         (LINK_FRAME_HEADER_SIZE + LINK_FRAME_MAX_PAYLOAD + 1)
+
+/* Encoded size: one COBS code byte per 254 bytes plus the delimiter */
+#define LINK_FRAME_MAX_ENCODED_SIZE (LINK_FRAME_MAX_SIZE + (LINK_FRAME_MAX_SIZE / 254) + 2)
+
+/* Inter-byte gap that ends a frame, several byte times at the slowest baud profile */
+#define LINK_FRAME_IDLE_MS          5
+
+/* Frame types sent by the HMI ECU (not acknowledged, seq is 0) */
+#define LINK_FRAME_TYPE_COMMAND     0x01
+#define LINK_FRAME_TYPE_TICK        0x02
+#define LINK_FRAME_TYPE_REPEAT      0x03
+#define LINK_FRAME_TYPE_SUBSCRIBE   0x04
+#define LINK_FRAME_TYPE_FREEZE_REQUEST  0x05
+
+/* Frame types sent by the Control ECU (acknowledged by seq) */
+#define LINK_FRAME_TYPE_ACK         0x06
+#define LINK_FRAME_TYPE_TELEMETRY   0x10
+#define LINK_FRAME_TYPE_FAULTS      0x11
+#define LINK_FRAME_TYPE_STATS       0x12
+#define LINK_FRAME_TYPE_PUSH        0x13
+#define LINK_FRAME_TYPE_FREEZE_FRAME    0x14
+
+/* Frame types of the bulk transfer (see link_transfer.h), sent both ways */
+#define LINK_FRAME_TYPE_BULK_START  0x20
+#define LINK_FRAME_TYPE_BULK_BLOCK  0x21
+#define LINK_FRAME_TYPE_WINDOW_ACK  0x22
+#define LINK_FRAME_TYPE_BULK_NACK   0x23
+
+/* Telemetry payload size in bytes */
+#define LINK_FRAME_TELEMETRY_SIZE   7
+
+/* Fault counters payload size in bytes (P001, P002, result of the last EEPROM access as TWI_ErrorType, 0 = OK) */
+#define LINK_FRAME_FAULTS_SIZE      3
+
+/* Link statistics payload size in bytes (see LinkFrame_packStats) */
+#define LINK_FRAME_STATS_SIZE       20
+
+/* Subscription payload size in bytes (see LinkFrame_packSubscribe) */
+#define LINK_FRAME_SUBSCRIBE_SIZE   4
+
+/* Freeze-frame payload size in bytes (see LinkFrame_packFreezeFrame) */
+#define LINK_FRAME_FREEZE_FRAME_SIZE    15
+
+/*
+ * Repeat value that ends a fault counter session and starts freeze-frame
+ * browsing: the HMI sends freeze requests carrying the event index
+ * (0 is the newest) and the Control ECU answers each with a freeze-frame,
+ * with an empty payload when there is no such event.
+ * LINK_FRAME_FREEZE_DONE as index ends browsing.
+ */
+#define LINK_FRAME_REPEAT_FREEZE_FRAMES 2
+#define LINK_FRAME_FREEZE_DONE          0xFF
+
+/*
+ * Push frame payload: a bitmask of the telemetry fields that follow, then
+ * only those fields in this order, in the same encoding as the telemetry frame.
+ */
+#define LINK_FRAME_FIELD_TEMPERATURE    0x01
+#define LINK_FRAME_FIELD_DISTANCE       0x02
+#define LINK_FRAME_FIELD_WINDOW1        0x04
+#define LINK_FRAME_FIELD_WINDOW2        0x08
+#define LINK_FRAME_FIELD_DIST_ERRORS    0x10
+#define LINK_FRAME_FIELD_TEMP_ERRORS    0x20
+#define LINK_FRAME_FIELD_ALL            0x3F
+
+/* Time to wait for the ACK of a frame before sending it again */
+#define LINK_FRAME_ACK_TIMEOUT_MS   100
+
+/* Number of retransmissions after the first try before giving up */
+#define LINK_FRAME_MAX_RETRIES      3
+
+/* Longest time a reply frame can take, including all retransmissions */
+#define LINK_FRAME_RESPONSE_TIMEOUT_MS  1000
+
+/* Longest silence from the HMI before the Control ECU ends a session */
+#define LINK_FRAME_SESSION_TIMEOUT_MS   2000
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* One decoded frame */
+typedef struct {
+    uint8 type;                             /* Frame type */
+    uint8 length;                           /* Number of payload bytes */
+    uint8 seq;                              /* Sequence number */
+    uint8 payload[LINK_FRAME_MAX_PAYLOAD];  /* Payload bytes */
+} LinkFrame_Type;
+
+/* Snapshot of all values shown on the HMI in one telemetry frame */
+typedef struct {
+    uint8 temperature;          /* Engine temperature in C */
+    uint16 distance;            /* Obstacle distance in cm */
+    uint8 window1_state;        /* DcMotor_State of window 1 */
+    uint8 window2_state;        /* DcMotor_State of window 2 */
+    uint8 dist_error_counter;   /* P001 counter */
+    uint8 temp_error_counter;   /* P002 counter */
+} LinkFrame_TelemetryType;
+
+/* Push subscription requested by the HMI ECU */
+typedef struct {
+    uint8 temperature_deadband; /* Push when the temperature moved more than this (C) */
+    uint8 distance_deadband;    /* Push when the distance moved more than this (cm) */
+    uint16 max_interval_ms;     /* Push all fields at least this often */
+} LinkFrame_SubscribeType;
+
+/* One logged DTC event with the conditions when it fired */
+typedef struct {
+    uint8 dtc;                  /* Index in the faults payload (P001, P002) */
+    uint8 index;                /* Event index, 0 is the newest */
+    uint16 count;               /* Counter total after this event */
+    uint8 temperature;          /* Engine temperature in C */
+    uint16 distance;            /* Obstacle distance in cm */
+    uint8 window1_state;        /* DcMotor_State of window 1 */
+    uint8 window2_state;        /* DcMotor_State of window 2 */
+    uint16 since_last_s;        /* Seconds since the previous event of this DTC, 0xFFFF if unknown */
+    uint32 uptime_s;            /* Seconds since boot of the Control ECU */
+} LinkFrame_FreezeFrameType;
+
+/*******************************************************************************
+ *                              Functions Prototypes                           *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Resets the receive decoder and makes an idle line end a frame.
+ * Call after UART_init and Systick_init.
+ */
+void LinkFrame_init(void);
+
+/*
+ * Description :
+ * Calculates the CRC-8 (polynomial 0x07, initial value 0) of a buffer.
+ */
+uint8 LinkFrame_crc8(uint8 crc, const uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Builds a frame around the payload and sends it in one burst.
+ * Waits only while the previous frame is still being transmitted.
+ */
+void LinkFrame_send(uint8 type, uint8 seq, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Builds a frame around the payload in the module's transmit buffer and
+ * returns immediately, the UART interrupt streams it out with no further
+ * copy and calls done (from interrupt context, may be NULL_PTR) at the end.
+ * Returns FALSE without sending if the previous frame is still in progress.
+ */
+boolean LinkFrame_sendAsync(uint8 type, uint8 seq, const uint8 *payload, uint8 length, void (*done)(void));
+
+/*
+ * Description :
+ * Non-blocking receive. Feeds the bytes waiting in the UART RX buffer to the
+ * frame parser. Returns TRUE and fills frame when a complete frame with a
+ * valid CRC has been received, otherwise FALSE.
+ */
+boolean LinkFrame_poll(LinkFrame_Type *frame);
+
+/*
+ * Description :
+ * Puts a received frame back, the next receive returns it again. Lets a
+ * loop that waits for one frame type leave other frames to their owner.
+ */
+void LinkFrame_putBack(const LinkFrame_Type *frame);
+
+/*
+ * Description :
+ * Blocking receive. Waits until a complete valid frame is received.
+ */
+void LinkFrame_receive(LinkFrame_Type *frame);
+
+/*
+ * Description :
+ * Waits at most timeout_ms milliseconds for a complete valid frame.
+ * Returns TRUE if frame was filled, FALSE on timeout.
+ */
+boolean LinkFrame_receiveTimeout(LinkFrame_Type *frame, uint16 timeout_ms);
+
+/*
+ * Description :
+ * Sends a frame carrying a single byte value (command, tick, repeat).
+ */
+void LinkFrame_sendValue(uint8 type, uint8 value);
+
+/*
+ * Description :
+ * Waits at most timeout_ms milliseconds for a frame of the given type and
+ * stores its first payload byte in value. Frames of other types are dropped.
+ * Returns TRUE if value was received, FALSE on timeout.
+ */
+boolean LinkFrame_receiveValue(uint8 type, uint8 *value, uint16 timeout_ms);
+
+/*
+ * Description :
+ * Acknowledges the frame with the given sequence number.
+ */
+void LinkFrame_sendAck(uint8 seq);
+
+/*
+ * Description :
+ * Waits at most LINK_FRAME_ACK_TIMEOUT_MS for the ACK of the given sequence
+ * number. A non-ACK frame received meanwhile is kept and returned by the
+ * next receive call. Returns TRUE if the ACK was received.
+ */
+boolean LinkFrame_waitForAck(uint8 seq);
+
+/*
+ * Description :
+ * Sends a frame and waits for its ACK, sending it again up to
+ * LINK_FRAME_MAX_RETRIES times. Returns TRUE if the frame was acknowledged,
+ * so the worst case blocking time is bounded by
+ * (LINK_FRAME_MAX_RETRIES + 1) * LINK_FRAME_ACK_TIMEOUT_MS.
+ */
+boolean LinkFrame_sendReliable(uint8 type, uint8 seq, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Receiver side of LinkFrame_sendReliable. Waits at most timeout_ms for a
+ * frame of the given type and acknowledges it. A retransmitted copy of the
+ * last accepted frame (same type and seq) is acknowledged again but not returned.
+ * Returns TRUE if a new frame was stored in frame, FALSE on timeout.
+ */
+boolean LinkFrame_receiveReliable(uint8 type, LinkFrame_Type *frame, uint16 timeout_ms);
+
+/*
+ * Description :
+ * Serializes/deserializes a telemetry snapshot to/from a frame payload.
+ */
+void LinkFrame_packTelemetry(const LinkFrame_TelemetryType *telemetry, uint8 *payload);
+void LinkFrame_unpackTelemetry(const uint8 *payload, LinkFrame_TelemetryType *telemetry);
+
+/*
+ * Description :
+ * Serializes/deserializes the UART link statistics to/from a frame payload.
+ */
+void LinkFrame_packStats(const UART_StatsType *stats, uint8 *payload);
+void LinkFrame_unpackStats(const uint8 *payload, UART_StatsType *stats);
+
+/*
+ * Description :
+ * Serializes/deserializes a push subscription to/from a frame payload.
+ */
+void LinkFrame_packSubscribe(const LinkFrame_SubscribeType *subscribe, uint8 *payload);
+void LinkFrame_unpackSubscribe(const uint8 *payload, LinkFrame_SubscribeType *subscribe);
+
+/*
+ * Description :
+ * Serializes the telemetry fields selected by the fields bitmask into a push
+ * frame payload. Returns the payload length.
+ */
+uint8 LinkFrame_packDelta(const LinkFrame_TelemetryType *telemetry, uint8 fields, uint8 *payload);
+
+/*
+ * Description :
+ * Updates only the telemetry fields carried by a push frame payload.
+ * Returns the bitmask of the updated fields, 0 if the payload is malformed.
+ */
+uint8 LinkFrame_unpackDelta(const uint8 *payload, uint8 length, LinkFrame_TelemetryType *telemetry);
+
+/*
+ * Description :
+ * Serializes/deserializes a logged DTC event to/from a frame payload.
+ */
+void LinkFrame_packFreezeFrame(const LinkFrame_FreezeFrameType *freeze_frame, uint8 *payload);
+void LinkFrame_unpackFreezeFrame(const uint8 *payload, LinkFrame_FreezeFrameType *freeze_frame);
+
+#endif /* LINK_FRAME_H_ */
@@ -0,0 +1,65 @@
+/*
+ * link_transfer.h
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#ifndef LINK_TRANSFER_H_
+#define LINK_TRANSFER_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Pipelined bulk transfer on top of link frames:
+ *
+ *  1. The sender announces the total length in a START frame (stop-and-wait).
+ *  2. It keeps up to LINK_TRANSFER_WINDOW BLOCK frames in flight, block n
+ *     carries bytes [n * LINK_TRANSFER_BLOCK_SIZE, ...) and seq = n mod 256.
+ *  3. The receiver answers with cumulative WINDOW_ACK frames (seq = next
+ *     block it expects) and one NACK per gap (seq = missing block), so only
+ *     the missing block is sent again.
+ *
+ * The frame types are LINK_FRAME_TYPE_BULK_* in link_frame.h.
+ */
+#define LINK_TRANSFER_BLOCK_SIZE    16      /* Data bytes per block (one 24C16 page) */
+#define LINK_TRANSFER_WINDOW        4       /* Blocks in flight, 1..8 */
+
+/* Time the receiver keeps answering duplicates after the last block */
+#define LINK_TRANSFER_LINGER_MS     (2 * LINK_FRAME_ACK_TIMEOUT_MS)
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* Reads length bytes starting at offset of the data being sent, returns FALSE on error */
+typedef boolean (*LinkTransfer_ReadType)(uint16 offset, uint8 *data, uint8 length);
+
+/* Stores length received bytes that belong at offset (blocks may arrive out of order) */
+typedef void (*LinkTransfer_WriteType)(uint16 offset, const uint8 *data, uint8 length);
+
+/*******************************************************************************
+ *                              Functions Prototypes                           *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Sends total_length bytes provided by read using the sliding window.
+ * Returns TRUE when the receiver acknowledged every block, FALSE if the
+ * read failed or a block stayed unacknowledged after LINK_FRAME_MAX_RETRIES.
+ */
+boolean LinkTransfer_send(uint16 total_length, LinkTransfer_ReadType read);
+
+/*
+ * Description :
+ * Receives a bulk transfer and hands every block to write. The total length
+ * is stored in total_length. Returns TRUE when all blocks were received,
+ * FALSE if the sender went silent for LINK_FRAME_SESSION_TIMEOUT_MS.
+ */
+boolean LinkTransfer_receive(uint16 *total_length, LinkTransfer_WriteType write);
+
+#endif /* LINK_TRANSFER_H_ */
@@ -9,12 +9,27 @@
 
 #include "keypad.h"
 #include "uart.h"
+#include "link_frame.h"
+#include "link_transfer.h"
 #include "lcd.h"
 #include "timer.h"
+#include "systick.h"
 #include <util/delay.h> /* For the delay functions */
 #include <avr/io.h>       /* Access to AVR IO registers */
 
-uint8 g_tick = 0;
+/* Length of the live push view in timer ticks (seconds) */
+#define PUSH_VIEW_TICKS                 10
+
+/* Push subscription settings sent to MC2 */
+#define PUSH_TEMP_DEADBAND              1       /* C */
+#define PUSH_DISTANCE_DEADBAND          2       /* cm */
+#define PUSH_MAX_INTERVAL_MS            2000
+
+volatile uint8 g_tick = 0;
+
+/* Byte count and additive checksum of the last EEPROM dump */
+uint16 g_dumpBytes = 0;
+uint16 g_dumpChecksum = 0;
 
 /* Timer1 callback function increments global tick counter */
 void Timer1_callback_fun(void)
@@ -22,6 +37,22 @@ void Timer1_callback_fun(void)
     g_tick++;
 }
 
+/*
+ * Bulk transfer sink for the EEPROM dump. Blocks can arrive out of order,
+ * so an order independent checksum is used.
+ */
+static void Dump_storeBlock(uint16 offset, const uint8 *data, uint8 length)
+{
+    uint8 i;
+
+    (void)offset;
+    for(i = 0; i < length; i++)
+    {
+        g_dumpChecksum += data[i];
+    }
+    g_dumpBytes += length;
+}
+
 /* Enum for the motor rotation states */
 typedef enum {
     OPEN_WINDOW,    /* Clockwise rotation */
@@ -29,19 +60,163 @@ typedef enum {
     Stop           /* Stop the motor */
 } DcMotor_State;
 
+/* Short window state names for the dashboard screen */
+static void Window_displayState(uint8 row, uint8 col, DcMotor_State state)
+{
+    switch(state)
+    {
+        case OPEN_WINDOW:
+            LCD_displayStringRowColumn(row, col, "Open ");
+            break;
+        case CLOSE_WINDOW:
+            LCD_displayStringRowColumn(row, col, "Close");
+            break;
+        case Stop:
+            LCD_displayStringRowColumn(row, col, "Stop ");
+            break;
+    }
+}
+
+/* Shows a value right aligned in a 3 character field */
+static void Value_display(uint8 row, uint8 col, uint16 value)
+{
+    LCD_displayStringRowColumn(row, col, "   ");
+    if(value < 10)
+    {
+        col += 2;
+    }
+    else if(value < 100)
+    {
+        col += 1;
+    }
+    LCD_moveCursor(row, col);
+    LCD_intgerToString(value);
+}
+
+/* Shows the freeze-frame of one logged DTC event */
+static void Faults_displayFreezeFrame(const LinkFrame_FreezeFrameType *freeze_frame)
+{
+    LCD_clearScreen();
+    LCD_displayStringRowColumn(0,0,(0 == freeze_frame->dtc) ? "P001" : "P002");
+    LCD_displayStringRowColumn(0,5,"#");
+    LCD_intgerToString(freeze_frame->index + 1);
+    LCD_displayStringRowColumn(0,10,"x");
+    LCD_intgerToString(freeze_frame->count);
+
+    LCD_displayStringRowColumn(1,0,"T:");
+    LCD_intgerToString(freeze_frame->temperature);
+    LCD_displayStringRowColumn(1,7,"D:");
+    LCD_intgerToString(freeze_frame->distance);
+    LCD_displayString((uint8 *)"cm");
+
+    LCD_displayStringRowColumn(2,0,"W1:");
+    Window_displayState(2, 3, (DcMotor_State)freeze_frame->window1_state);
+    LCD_displayStringRowColumn(2,8,"W2:");
+    Window_displayState(2, 11, (DcMotor_State)freeze_frame->window2_state);
+
+    /* Time since the previous event of the same DTC, minutes once it gets long */
+    LCD_displayStringRowColumn(3,0,"Prev:");
+    if(0xFFFF == freeze_frame->since_last_s)
+    {
+        LCD_displayString((uint8 *)"--");
+    }
+    else if(freeze_frame->since_last_s < 1000)
+    {
+        LCD_intgerToString(freeze_frame->since_last_s);
+        LCD_displayCharacter('s');
+    }
+    else
+    {
+        LCD_intgerToString(freeze_frame->since_last_s / 60);
+        LCD_displayCharacter('m');
+    }
+    LCD_displayStringRowColumn(3,12,"+/-");
+}
+
+/*
+ * Freeze-frame browser, MC2 answers each request with one logged event.
+ * '+' shows the next older event, '-' the next newer one and any other
+ * key ends browsing.
+ */
+static void Faults_browse(void)
+{
+    uint8 index = 0, key;
+    boolean shown;
+    LinkFrame_Type frame;
+    LinkFrame_FreezeFrameType freeze_frame;
+
+    while(1)
+    {
+        LinkFrame_sendValue(LINK_FRAME_TYPE_FREEZE_REQUEST, index);
+
+        shown = FALSE;
+        if(!LinkFrame_receiveReliable(LINK_FRAME_TYPE_FREEZE_FRAME, &frame, LINK_FRAME_RESPONSE_TIMEOUT_MS))
+        {
+            LCD_clearScreen();
+            LCD_displayStringRowColumn(0,0,"No response");
+        }
+        else if(frame.length < LINK_FRAME_FREEZE_FRAME_SIZE)
+        {
+            LCD_clearScreen();
+            LCD_displayStringRowColumn(0,0,(0 == index) ? "No events logged" : "No older events");
+        }
+        else
+        {
+            LinkFrame_unpackFreezeFrame(frame.payload, &freeze_frame);
+            Faults_displayFreezeFrame(&freeze_frame);
+            shown = TRUE;
+        }
+
+        key = KEYPAD_getPressedKey();
+        _delay_ms(500);
+
+        if('+' == key)
+        {
+            /* Stay on the oldest event, the index is a byte */
+            if(shown && (index < LINK_FRAME_FREEZE_DONE - 1))
+            {
+                index++;
+            }
+        }
+        else if('-' == key)
+        {
+            if(index > 0)
+            {
+                index--;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    LinkFrame_sendValue(LINK_FRAME_TYPE_FREEZE_REQUEST, LINK_FRAME_FREEZE_DONE);
+}
+
 int main(void)
 {
     /* Variable declarations and initialization */
-    uint8 key = 0, temp = 0, distance_high_byte = 0, distance_low_byte = 0, repeat = 1;
+    uint8 key = 0, temp = 0, repeat = 1;
     uint8 P001_Dist_error_counter = 0, P002_Temp_error_counter = 0;
-    uint8 tick_loop_counter = 0, check = 0, tick_prev = 0;
+    uint8 tick_loop_counter = 0, tick_prev = 0;
     uint16 distance = 0;
     DcMotor_State window1_state, window2_state;
-
-    /* UART configuration */
-    UART_ConfigType ConfigUART_Ptr = {BIT_DATA_8, PARITY_DISABLED, STOP_BIT_1, 9600};
+    LinkFrame_Type frame;
+    LinkFrame_TelemetryType telemetry;
+    UART_StatsType link_stats;
+    uint16 dump_length = 0;
+    uint8 push_fields = 0;
+    uint8 subscribe_payload[LINK_FRAME_SUBSCRIBE_SIZE];
+    LinkFrame_SubscribeType subscribe = {PUSH_TEMP_DEADBAND, PUSH_DISTANCE_DEADBAND, PUSH_MAX_INTERVAL_MS};
+    uint32 dump_start_ms = 0;
+
+    /* UART configuration, both ECUs use the same link baud rate profile */
+    UART_ConfigType ConfigUART_Ptr = {BIT_DATA_8, PARITY_DISABLED, STOP_BIT_1, UART_LINK_BAUD_RATE, UART_NO_ADDRESS};
     UART_init(&ConfigUART_Ptr);
     LCD_init();
+    Systick_init();
+    LinkFrame_init();
 
     /* Timer1 configuration for 1-second intervals (with prescaler 1024 and compare value 15625) */
     Timer_ConfigType Config_Ptr = {0, 15625, TIMER1, PRESCALER_1024, COMPARE_MODE};
@@ -51,18 +226,17 @@ int main(void)
 
     while(1)
     {
-        /* Display main menu on LCD */
+        /* Display main menu on LCD, the dashboard fills one screen from a single request */
         LCD_clearScreen();
-        LCD_displayStringRowColumn(0,0,"1.StartOperation");
-        LCD_displayStringRowColumn(1,0,"2.Display Values");
-        LCD_displayStringRowColumn(2,0,"3.RetrieveFaults");
-        LCD_displayStringRowColumn(3,0,"4.StopMonitoring");
+        LCD_displayStringRowColumn(0,0,"1.Start 2.Values");
+        LCD_displayStringRowColumn(1,0,"3.Faults 4.Stop");
+        LCD_displayStringRowColumn(2,0,"7.Dashboard");
 
         /* Get keypad input */
         key = KEYPAD_getPressedKey();
 
         /* Send selected key via UART to MC2 */
-        UART_sendByte(key);
+        LinkFrame_sendValue(LINK_FRAME_TYPE_COMMAND, key);
 
         _delay_ms(500);
 
@@ -79,13 +253,18 @@ int main(void)
                 LCD_displayStringRowColumn(0,0,"OperationStarted");
                 LCD_displayStringRowColumn(1,0,"MonitoringActive");
 
-                /* Send tick values until tick reaches 5 */
-                UART_sendByte(g_tick);
+                /* Send each new tick value until tick reaches 5 */
+                tick_prev = g_tick;
+                LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, tick_prev);
                 while(g_tick < 5)
                 {
-                    UART_sendByte(g_tick);
+                    if(g_tick != tick_prev)
+                    {
+                        tick_prev = g_tick;
+                        LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, tick_prev);
+                    }
                 }
-                UART_sendByte(g_tick);
+                LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
 
                 /* Deinitialize timer */
                 Timer_deInit(TIMER1);
@@ -107,19 +286,16 @@ int main(void)
                     LCD_displayStringRowColumn(1,0,"Dist = ");
                     LCD_displayStringRowColumn(1, 10, " cm");
 
-                    UART_sendByte(g_tick);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
 
                     /* Loop until 5 timer ticks have elapsed */
                     while(g_tick < 5)
                     {
-                        UART_sendByte(g_tick);
-                        tick_prev = g_tick;
+                        LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
                         _delay_ms(200);
 
                         if(tick_loop_counter > 0)
                         {
-                            distance = (distance_high_byte << 8) | distance_low_byte;
-
                             /* Display temperature */
                             LCD_moveCursor(0, 7);
                             LCD_intgerToString(temp);
@@ -180,25 +356,20 @@ int main(void)
                         }
                         tick_loop_counter++;
 
-                        /* Receive temperature and send ACK */
-                        temp = UART_recieveByte();
-                        UART_sendACK();
-
-                        /* Receive high byte of distance and send ACK */
-                        distance_high_byte = UART_recieveByte();
-                        UART_sendACK();
-
-                        /* Receive low byte of distance and send ACK */
-                        distance_low_byte = UART_recieveByte();
-                        UART_sendACK();
-
-                        /* Receive motor states for windows and send ACK */
-                        window1_state = UART_recieveByte();
-                        UART_sendACK();
-                        window2_state = UART_recieveByte();
+                        /* Receive the telemetry snapshot frame, the old values stay on a timeout */
+                        if(LinkFrame_receiveReliable(LINK_FRAME_TYPE_TELEMETRY, &frame, LINK_FRAME_RESPONSE_TIMEOUT_MS))
+                        {
+                            LinkFrame_unpackTelemetry(frame.payload, &telemetry);
+                            temp = telemetry.temperature;
+                            distance = telemetry.distance;
+                            window1_state = telemetry.window1_state;
+                            window2_state = telemetry.window2_state;
+                            P001_Dist_error_counter = telemetry.dist_error_counter;
+                            P002_Temp_error_counter = telemetry.temp_error_counter;
+                        }
                     }
 
-                    UART_sendByte(g_tick);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
 
                     tick_loop_counter = 0;
 
@@ -224,7 +395,7 @@ int main(void)
                     }
 
                     /* Send repeat response to MC2 */
-                    UART_sendByte(repeat);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_REPEAT, repeat);
                     _delay_ms(200);
                 }
                 repeat = 1;
@@ -245,17 +416,32 @@ int main(void)
                     LCD_displayStringRowColumn(2,0,"P002: ");
                     LCD_displayStringRowColumn(3,0,"--End of List--");
 
-                    UART_sendByte(g_tick);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
 
                     while(g_tick < 5)
                     {
-                        UART_sendByte(g_tick);
+                        LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
                         _delay_ms(200);
 
-                        /* Receive fault counters for distance and temperature */
-                        P001_Dist_error_counter = UART_recieveByte();
-                        UART_sendACK();
-                        P002_Temp_error_counter = UART_recieveByte();
+                        /* Receive fault counters for distance and temperature in one frame */
+                        if(LinkFrame_receiveReliable(LINK_FRAME_TYPE_FAULTS, &frame, LINK_FRAME_RESPONSE_TIMEOUT_MS))
+                        {
+                            P001_Dist_error_counter = frame.payload[0];
+                            P002_Temp_error_counter = frame.payload[1];
+
+                            /* The Control ECU could not access its EEPROM, show the failed stage */
+                            if((frame.length >= LINK_FRAME_FAULTS_SIZE) && (frame.payload[2] != 0))
+                            {
+                                LCD_displayStringRowColumn(3,0,"EEPROM error    ");
+                                LCD_moveCursor(3, 13);
+                                LCD_intgerToString(frame.payload[2]);
+                            }
+                            else
+                            {
+                                /* The last access succeeded again */
+                                LCD_displayStringRowColumn(3,0,"--End of List-- ");
+                            }
+                        }
 
                         /* Display faults on LCD */
                         LCD_moveCursor(1, 6);
@@ -282,7 +468,7 @@ int main(void)
                         }
                     }
 
-                    UART_sendByte(g_tick);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_TICK, g_tick);
                     _delay_ms(200);
 
                     /* Deinitialize timer */
@@ -293,6 +479,7 @@ int main(void)
                     LCD_displayStringRowColumn(0,0,"Display again?");
                     LCD_displayStringRowColumn(1,0,"Press 3 = YES");
                     LCD_displayStringRowColumn(2,0,"Other key = MAIN MENU");
+                    LCD_displayStringRowColumn(3,0,"+ = FreezeFrames");
 
                     key = KEYPAD_getPressedKey();
                     _delay_ms(500);
@@ -301,12 +488,22 @@ int main(void)
                     {
                         repeat = 1;
                     }
+                    else if('+' == key)
+                    {
+                        repeat = LINK_FRAME_REPEAT_FREEZE_FRAMES;
+                    }
                     else
                     {
                         repeat = 0;
                     }
 
-                    UART_sendByte(repeat);
+                    LinkFrame_sendValue(LINK_FRAME_TYPE_REPEAT, repeat);
+                    if(LINK_FRAME_REPEAT_FREEZE_FRAMES == repeat)
+                    {
+                        /* MC2 waits for the freeze requests, the session ends with browsing */
+                        Faults_browse();
+                        repeat = 0;
+                    }
                     _delay_ms(200);
                 }
                 repeat = 1;
@@ -332,6 +529,159 @@ int main(void)
                 /* Deinitialize timer */
                 Timer_deInit(TIMER1);
                 break;
+
+            case 5: /* Diagnostics (not in the menu): link statistics of MC2 */
+                LCD_clearScreen();
+
+                if(LinkFrame_receiveReliable(LINK_FRAME_TYPE_STATS, &frame, LINK_FRAME_RESPONSE_TIMEOUT_MS))
+                {
+                    LinkFrame_unpackStats(frame.payload, &link_stats);
+
+                    LCD_displayStringRowColumn(0,0,"Ovr:");
+                    LCD_intgerToString(link_stats.overruns);
+                    LCD_displayStringRowColumn(0,8,"FE:");
+                    LCD_intgerToString(link_stats.framing_errors);
+                    LCD_displayStringRowColumn(1,0,"PE:");
+                    LCD_intgerToString(link_stats.parity_errors);
+                    LCD_displayStringRowColumn(1,8,"Drop:");
+                    LCD_intgerToString(link_stats.rx_buffer_drops);
+                    LCD_displayStringRowColumn(2,0,"Retransmit:");
+                    LCD_intgerToString(link_stats.retransmits);
+                    LCD_displayStringRowColumn(3,0,"AckMax:");
+                    LCD_intgerToString(link_stats.max_ack_wait_ticks);
+                    LCD_displayString((uint8 *)" ms");
+                }
+                else
+                {
+                    LCD_displayStringRowColumn(0,0,"MC2 no reply");
+                }
+
+                /* Keep the values on the screen until any key is pressed */
+                KEYPAD_getPressedKey();
+                _delay_ms(500);
+                break;
+
+            case 6: /* Diagnostics (not in the menu): full EEPROM dump from MC2 */
+                LCD_clearScreen();
+                LCD_displayStringRowColumn(0,0,"EEPROM dump...");
+
+                g_dumpBytes = 0;
+                g_dumpChecksum = 0;
+                dump_start_ms = Systick_getMs();
+
+                if(LinkTransfer_receive(&dump_length, Dump_storeBlock))
+                {
+                    LCD_displayStringRowColumn(0,0,"Dump bytes:");
+                    LCD_intgerToString(g_dumpBytes);
+                    LCD_displayStringRowColumn(1,0,"Sum:");
+                    LCD_intgerToString(g_dumpChecksum);
+                    LCD_displayStringRowColumn(2,0,"Time:");
+                    LCD_intgerToString((uint16)(Systick_getMs() - dump_start_ms));
+                    LCD_displayString((uint8 *)" ms");
+                }
+                else
+                {
+                    LCD_displayStringRowColumn(1,0,"Dump failed");
+                }
+
+                KEYPAD_getPressedKey();
+                _delay_ms(500);
+                break;
+
+            case 7: /* Dashboard: every value from one get all request */
+                do
+                {
+                    LCD_clearScreen();
+
+                    if(LinkFrame_receiveReliable(LINK_FRAME_TYPE_TELEMETRY, &frame, LINK_FRAME_RESPONSE_TIMEOUT_MS))
+                    {
+                        LinkFrame_unpackTelemetry(frame.payload, &telemetry);
+
+                        LCD_displayStringRowColumn(0,0,"T:");
+                        LCD_intgerToString(telemetry.temperature);
+                        LCD_displayStringRowColumn(0,8,"D:");
+                        LCD_intgerToString(telemetry.distance);
+                        LCD_displayStringRowColumn(1,0,"W1:");
+                        Window_displayState(1, 3, telemetry.window1_state);
+                        LCD_displayStringRowColumn(1,8,"W2:");
+                        Window_displayState(1, 11, telemetry.window2_state);
+                        LCD_displayStringRowColumn(2,0,"P001:");
+                        LCD_intgerToString(telemetry.dist_error_counter);
+                        LCD_displayStringRowColumn(2,8,"P002:");
+                        LCD_intgerToString(telemetry.temp_error_counter);
+                    }
+                    else
+                    {
+                        LCD_displayStringRowColumn(0,0,"MC2 no reply");
+                    }
+                    LCD_displayStringRowColumn(3,0,"7 = Refresh");
+
+                    key = KEYPAD_getPressedKey();
+                    _delay_ms(500);
+
+                    /* Each refresh is one more get all request to MC2 */
+                    if(7 == key)
+                    {
+                        LinkFrame_sendValue(LINK_FRAME_TYPE_COMMAND, key);
+                    }
+                } while(7 == key);
+                break;
+
+            case 8: /* Live view (not in the menu): MC2 pushes only the values that changed */
+                LCD_clearScreen();
+                LCD_displayStringRowColumn(0,0,"Temp:     C");
+                LCD_displayStringRowColumn(1,0,"Dist:     cm");
+                LCD_displayStringRowColumn(2,0,"W1:");
+                LCD_displayStringRowColumn(2,8,"W2:");
+                LCD_displayStringRowColumn(3,0,"P001:");
+                LCD_displayStringRowColumn(3,8,"P002:");
+
+                LinkFrame_packSubscribe(&subscribe, subscribe_payload);
+                LinkFrame_send(LINK_FRAME_TYPE_SUBSCRIBE, 0, subscribe_payload, LINK_FRAME_SUBSCRIBE_SIZE);
+
+                g_tick = 0;
+                Timer_init(&Config_Ptr);
+                Timer_setCallBack(Timer1_callback_fun, TIMER1);
+
+                /* Redraw only what a push frame carries */
+                while(g_tick < PUSH_VIEW_TICKS)
+                {
+                    if(!LinkFrame_receiveReliable(LINK_FRAME_TYPE_PUSH, &frame, 0))
+                    {
+                        continue;
+                    }
+
+                    push_fields = LinkFrame_unpackDelta(frame.payload, frame.length, &telemetry);
+                    if(push_fields & LINK_FRAME_FIELD_TEMPERATURE)
+                    {
+                        Value_display(0, 6, telemetry.temperature);
+                    }
+                    if(push_fields & LINK_FRAME_FIELD_DISTANCE)
+                    {
+                        Value_display(1, 6, telemetry.distance);
+                    }
+                    if(push_fields & LINK_FRAME_FIELD_WINDOW1)
+                    {
+                        Window_displayState(2, 3, telemetry.window1_state);
+                    }
+                    if(push_fields & LINK_FRAME_FIELD_WINDOW2)
+                    {
+                        Window_displayState(2, 11, telemetry.window2_state);
+                    }
+                    if(push_fields & LINK_FRAME_FIELD_DIST_ERRORS)
+                    {
+                        Value_display(3, 5, telemetry.dist_error_counter);
+                    }
+                    if(push_fields & LINK_FRAME_FIELD_TEMP_ERRORS)
+                    {
+                        Value_display(3, 13, telemetry.temp_error_counter);
+                    }
+                }
+
+                /* Unsubscribe */
+                Timer_deInit(TIMER1);
+                LinkFrame_sendValue(LINK_FRAME_TYPE_REPEAT, 0);
+                break;
         }
     }
 }
@@ -0,0 +1,70 @@
+/*
+ * systick.c
+ *
+ *  Created on: Nov 1, 2025
+ *      Author: Fatma Foley
+ */
+
+#include "systick.h"
+#include "timer.h"
+#include "common_macros.h"
+#include <avr/io.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Milliseconds since Systick_init */
+static volatile uint32 g_systickMs = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/* Timer0 compare callback, called every 1 ms */
+static void Systick_callBack(void)
+{
+    g_systickMs++;
+}
+
+/*
+ * Description :
+ * Timer1 is used by the application for the 1 second display ticks,
+ * so the system tick runs on Timer0 through the timer driver:
+ *  - Compare mode with prescaler 64 and compare value 124 (1 ms at 8 MHz)
+ */
+void Systick_init(void)
+{
+    Timer_ConfigType Systick_Config = {0, SYSTICK_COMPARE_VALUE, TIMER0, PRESCALER_64, COMPARE_MODE};
+
+    g_systickMs = 0;
+
+    Timer_init(&Systick_Config);
+    Timer_setCallBack(Systick_callBack, TIMER0);
+}
+
+/*
+ * Description :
+ * Reads the 32-bit counter with the interrupts disabled so the ISR can not
+ * update it in the middle of the read.
+ */
+uint32 Systick_getMs(void)
+{
+    uint32 ms;
+    uint8 sreg = SREG;
+
+    CLEAR_BIT(SREG, 7);
+    ms = g_systickMs;
+    SREG = sreg;
+
+    return ms;
+}
+
+/*
+ * Description :
+ * Unsigned subtraction keeps the result correct when the counter wraps.
+ */
+boolean Systick_isElapsed(uint32 start_ms, uint32 timeout_ms)
+{
+    return ((Systick_getMs() - start_ms) >= timeout_ms) ? TRUE : FALSE;
+}
@@ -14,8 +14,70 @@
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 
-/* Define maximum timeout value for ACK waiting loops */
-#define TIMEOUT_MAX 10000
+/* Maximum time to wait for an ACK byte in milliseconds (measured by the system tick) */
+#define UART_ACK_TIMEOUT_MS 50
+
+/*
+ * Size of the interrupt driven RX and TX ring buffers in bytes.
+ * Must be a power of two and not larger than 128 (indexes are uint8).
+ */
+#define UART_RX_BUFFER_SIZE 64
+#define UART_TX_BUFFER_SIZE 64
+
+/* Byte stored in the RX buffer when the idle line delimiter ends a frame */
+#define UART_IDLE_DELIMITER 0x00
+
+/*
+ * Multi-drop bus (multi-processor communication mode, BIT_DATA_9 only):
+ * a byte with the 9th bit set is an address, the other bytes are data.
+ * A node with an address keeps MPCM set, so the hardware drops all data
+ * bytes without an interrupt until the node sees its own address. Any
+ * other address puts it back to sleep. UART_NO_ADDRESS turns this off.
+ */
+#define UART_NO_ADDRESS     0x00
+
+/*
+ * Link baud rate profiles. Error for F_CPU = 8 MHz with the mode picked
+ * automatically by the baud rate calculator:
+ *
+ *   Profile   U2X  UBRR  Actual baud  Error
+ *   9600       0    51      9615      0.16%
+ *   38400      0    12     38461      0.16%
+ *   76800      1    12     76923      0.16%  (normal mode would be 7.0%)
+ *   250000     0     1    250000      0.00%
+ */
+#define UART_BAUD_9600          9600UL
+#define UART_BAUD_38400         38400UL
+#define UART_BAUD_76800         76800UL
+#define UART_BAUD_250000        250000UL
+
+/* Baud rate used on the link between the two ECUs, must match on both sides */
+#define UART_LINK_BAUD_RATE     UART_BAUD_250000
+
+/* Highest accepted baud rate error in 0.1% units (2.0% per the ATmega32 datasheet for 8N1) */
+#define UART_MAX_BAUD_ERROR_PERMILLE    20
+
+/*
+ * Compile-time baud rate calculation (needs F_CPU).
+ * UBRR is rounded to the nearest value for normal (/16) and double speed (/8) mode.
+ */
+#define UART_UBRR_NORMAL(BAUD)      (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define UART_UBRR_DOUBLE(BAUD)      (((F_CPU) + 4UL * (BAUD)) / (8UL * (BAUD)) - 1UL)
+#define UART_ACTUAL_NORMAL(BAUD)    ((F_CPU) / (16UL * (UART_UBRR_NORMAL(BAUD) + 1UL)))
+#define UART_ACTUAL_DOUBLE(BAUD)    ((F_CPU) / (8UL * (UART_UBRR_DOUBLE(BAUD) + 1UL)))
+
+/* Absolute error between actual and requested baud rate in 0.1% units */
+#define UART_ERROR_PERMILLE(ACTUAL, BAUD) \
+    (((ACTUAL) > (BAUD)) ? (((ACTUAL) - (BAUD)) * 1000UL / (BAUD)) : (((BAUD) - (ACTUAL)) * 1000UL / (BAUD)))
+
+/* Double speed is used only when it is strictly more accurate than normal mode */
+#define UART_USE_U2X(BAUD) \
+    (UART_ERROR_PERMILLE(UART_ACTUAL_DOUBLE(BAUD), BAUD) < UART_ERROR_PERMILLE(UART_ACTUAL_NORMAL(BAUD), BAUD))
+
+/* Error of the best mode for BAUD in 0.1% units */
+#define UART_BAUD_ERROR_PERMILLE(BAUD) \
+    (UART_USE_U2X(BAUD) ? UART_ERROR_PERMILLE(UART_ACTUAL_DOUBLE(BAUD), BAUD) \
+                        : UART_ERROR_PERMILLE(UART_ACTUAL_NORMAL(BAUD), BAUD))
 
 /* Typedef for baud rate */
 typedef uint32 UART_BaudRateType;
@@ -51,28 +113,151 @@ typedef struct {
     UART_ParityType parity;         /* Parity setting */
     UART_StopBitType stop_bit;      /* Number of stop bits */
     UART_BaudRateType baud_rate;    /* Baud rate value */
+    uint8 node_address;             /* Multi-drop node address, UART_NO_ADDRESS for point to point */
 } UART_ConfigType;
 
+/* Link statistics and error counters kept by the driver */
+typedef struct {
+    uint32 bytes_in;                /* Bytes received (including dropped ones) */
+    uint32 bytes_out;               /* Bytes handed to the transmitter */
+    uint16 overruns;                /* DOR: byte lost in hardware before the ISR read UDR */
+    uint16 framing_errors;          /* FE: bad stop bit */
+    uint16 parity_errors;           /* PE: parity mismatch */
+    uint16 rx_buffer_drops;         /* Bytes dropped because the RX ring buffer was full */
+    uint16 retransmits;             /* Frames sent again after a missing ACK */
+    uint16 max_ack_wait_ticks;      /* Worst-case ACK wait in system ticks (1 ms) */
+} UART_StatsType;
+
+/* Result of the run-time baud rate calculation */
+typedef struct {
+    uint16 ubrr;                    /* Value for UBRRH:UBRRL */
+    boolean double_speed;           /* TRUE if U2X must be set */
+    uint16 error_permille;          /* Baud rate error in 0.1% units */
+} UART_BaudSettingType;
+
 /*
  * Description :
  * Function to initialize the UART peripheral.
  * Configures frame format, enables UART transmitter and receiver,
- * and sets the baud rate as per the configuration.
+ * and sets the baud rate as per the configuration (U2X is picked automatically).
  */
 void UART_init(const UART_ConfigType * Config_Ptr);
 
+/*
+ * Description :
+ * Calculates UBRR for both normal and double speed mode and picks the one
+ * with the lower baud rate error for F_CPU.
+ * Returns FALSE if the baud rate cannot be generated within
+ * UART_MAX_BAUD_ERROR_PERMILLE, TRUE otherwise.
+ */
+boolean UART_calculateBaudRate(UART_BaudRateType baud_rate, UART_BaudSettingType *setting);
+
 /*
  * Description :
  * Sends a single byte over UART.
+ * Blocks only while the TX ring buffer is full.
  */
 void UART_sendByte(const uint8 data);
 
 /*
  * Description :
  * Receives a single byte from UART.
+ * Blocks until a byte is available in the RX ring buffer.
  */
 uint8 UART_recieveByte(void);
 
+/*
+ * Description :
+ * Receives a single byte, waiting at most timeout_ms milliseconds.
+ * Returns TRUE if a byte was stored in data, FALSE on timeout.
+ * Needs the system tick (Systick_init) to be running.
+ */
+boolean UART_receiveTimeout(uint8 *data, uint16 timeout_ms);
+
+/*
+ * Description :
+ * Non-blocking receive. Copies up to len bytes from the RX ring buffer
+ * into data and returns the number of bytes actually copied (may be 0).
+ */
+uint8 UART_tryReceive(uint8 *data, uint8 len);
+
+/*
+ * Description :
+ * Non-blocking transmit. Queues up to len bytes from data into the TX ring
+ * buffer and returns the number of bytes actually queued (may be 0).
+ * The bytes are sent in the background by the UDRE interrupt.
+ */
+uint8 UART_write(const uint8 *data, uint8 len);
+
+/*
+ * Description :
+ * Blocking transmit of len bytes, waits only while the TX ring buffer is full.
+ */
+void UART_sendBuffer(const uint8 *data, uint8 len);
+
+/*
+ * Description :
+ * Zero-copy asynchronous transmit. The UDRE interrupt streams the bytes
+ * straight from buf (after anything already queued in the TX ring buffer)
+ * and calls done, if not NULL_PTR, from interrupt context when the last
+ * byte has been handed to the hardware. buf must stay valid and unchanged
+ * until then. Returns FALSE if another asynchronous transmit is in progress.
+ * While it is in progress UART_write queues nothing and UART_sendByte waits.
+ */
+boolean UART_sendBufferAsync(const uint8 *buf, uint8 len, void (*done)(void));
+
+/*
+ * Description :
+ * Returns TRUE while an asynchronous transmit started by UART_sendBufferAsync
+ * is still in progress.
+ */
+boolean UART_isAsyncBusy(void);
+
+/*
+ * Description :
+ * Copies a consistent snapshot of the link statistics into stats.
+ */
+void UART_getStats(UART_StatsType *stats);
+
+/*
+ * Description :
+ * Resets all link statistics to zero.
+ */
+void UART_clearStats(void);
+
+/*
+ * Description :
+ * Used by the protocol layers to report a retransmitted frame and the time
+ * an ACK took (or the time waited before giving up) in system ticks.
+ */
+void UART_recordRetransmit(void);
+void UART_recordAckWait(uint16 ticks);
+
+/*
+ * Description :
+ * Returns the number of received bytes waiting in the RX ring buffer.
+ */
+uint8 UART_available(void);
+
+/*
+ * Description :
+ * Makes an idle line mark the end of a frame. When idle_ms is not 0, the RX
+ * ISR stores UART_IDLE_DELIMITER in the RX buffer before any byte that comes
+ * after the line was idle for at least idle_ms, so a framed protocol that
+ * uses 0x00 as its delimiter (COBS) drops a broken frame at the next gap.
+ * Pass 0 to receive the raw byte stream again.
+ */
+void UART_setIdleDelimiter(uint16 idle_ms);
+
+/*
+ * Description :
+ * Selects the node that receives the following data bytes on a multi-drop
+ * bus by sending its address with the 9th bit set. Waits until everything
+ * queued before has been handed to the transmitter, since the 9th bit
+ * belongs to the byte in UDR. Needs BIT_DATA_9.
+ */
+void UART_sendAddress(uint8 address);
+
 /*
  * Description :
  * Sends a null-terminated string through UART.
@@ -83,6 +268,8 @@ void UART_sendString(const uint8 *Str);
  * Description :
  * Receives a string through UART until the '#' character is received.
  * The '#' is replaced with a null terminator.
+ * Text only: a binary byte of 0x23 would end the string, binary data
+ * goes through the link frames instead.
  */
 void UART_receiveString(uint8 *Str);
 
@@ -95,7 +282,7 @@ void UART_sendACK(void);
 /*
  * Description :
  * Waits to receive an ACK byte (0xAA) from UART transmitter.
- * Returns 1 if ACK received before timeout; otherwise 0.
+ * Returns 1 if ACK received within UART_ACK_TIMEOUT_MS; otherwise 0.
  */
 uint8 UART_waitForACK(void);
 